@@ -0,0 +1,78 @@
+#include "common/fd_waiter.h"
+
+#include <errno.h>
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace common {
+
+FdWaiter::FdWaiter() : epoll_fd_(epoll_create1(EPOLL_CLOEXEC)) {
+  PCHECK(epoll_fd_.is_valid());
+}
+
+FdWaiter::~FdWaiter() = default;
+
+void FdWaiter::Add(int fd) {
+  struct epoll_event ev = {};
+  ev.events = EPOLLIN;
+  ev.data.fd = fd;
+  if (epoll_ctl(epoll_fd_.get(), EPOLL_CTL_ADD, fd, &ev) != 0) {
+    PCHECK(errno == EPERM);
+    always_ready_fds_.push_back(fd);
+    return;
+  }
+  events_.resize(events_.size() + 1);
+}
+
+void FdWaiter::Remove(int fd) {
+  auto iter =
+      std::find(always_ready_fds_.begin(), always_ready_fds_.end(), fd);
+  if (iter != always_ready_fds_.end()) {
+    always_ready_fds_.erase(iter);
+    return;
+  }
+  PCHECK(epoll_ctl(epoll_fd_.get(), EPOLL_CTL_DEL, fd, nullptr) == 0);
+  events_.resize(events_.size() - 1);
+}
+
+std::vector<int> FdWaiter::Wait(const base::TimeTicks& deadline) {
+  if (!always_ready_fds_.empty())
+    return always_ready_fds_;
+  DCHECK(!events_.empty());
+  while (true) {
+    int timeout_ms;
+    if (deadline.is_null()) {
+      timeout_ms = -1;
+    } else {
+      timeout_ms = (deadline - base::TimeTicks::Now()).InMilliseconds();
+      if (timeout_ms <= 0) {
+        // Timed out.
+        return {};
+      }
+    }
+
+    int num_fds = epoll_wait(
+        epoll_fd_.get(), events_.data(), events_.size(), timeout_ms);
+    if (num_fds == -1) {
+      if (errno == EINTR)
+        continue;
+      NOTREACHED();
+      return {};
+    }
+    if (num_fds == 0) {
+      // EPOLL Timeout. Will return in the above check in the next
+      // iteration.
+      continue;
+    }
+
+    std::vector<int> result;
+    result.reserve(num_fds);
+    for (int i = 0; i < num_fds; ++i)
+      result.push_back(events_[i].data.fd);
+    return result;
+  }
+}
+
+}  // namespace common
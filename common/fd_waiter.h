@@ -0,0 +1,42 @@
+#ifndef COMMON_FD_WAITER_H_
+#define COMMON_FD_WAITER_H_
+
+#include <sys/epoll.h>
+
+#include <vector>
+
+#include "base/files/scoped_file.h"
+#include "base/macros.h"
+#include "base/time/time.h"
+
+namespace common {
+
+// Waits for any of a set of fds to become readable. Keeps one epoll instance
+// for its lifetime, so each wait is a single epoll_wait(2).
+class FdWaiter {
+ public:
+  FdWaiter();
+  ~FdWaiter();
+
+  // Starts and stops watching |fd|. A closed fd is dropped by the kernel.
+  // A regular file, which epoll does not take, is always ready.
+  void Add(int fd);
+  void Remove(int fd);
+
+  // Waits until a watched fd is readable or hung up, or |deadline| passes.
+  // A null |deadline| waits forever. Returns the ready fds, or an empty list
+  // on timeout.
+  std::vector<int> Wait(const base::TimeTicks& deadline);
+
+ private:
+  base::ScopedFD epoll_fd_;
+  std::vector<struct epoll_event> events_;
+  // Watched fds that epoll does not take, e.g. stdin redirected from a file.
+  std::vector<int> always_ready_fds_;
+
+  DISALLOW_COPY_AND_ASSIGN(FdWaiter);
+};
+
+}  // namespace common
+
+#endif  // COMMON_FD_WAITER_H_
@@ -1,9 +1,12 @@
 #include "common/game_data.h"
 
+#include <algorithm>
+
 #include "base/json/json_reader.h"
 #include "base/json/json_writer.h"
 #include "base/logging.h"
 #include "base/memory/ptr_util.h"
+#include "common/json_encoder.h"
 
 namespace common {
 
@@ -63,6 +66,13 @@ std::unique_ptr<base::Value> Site::ToJson(const Site& site) {
   return result;
 }
 
+void Site::WriteJson(const Site& site, JsonEncoder* encoder) {
+  encoder->BeginObject();
+  encoder->Key("id");
+  encoder->Int(site.id);
+  encoder->EndObject();
+}
+
 River River::FromJson(const base::Value& value_in) {
   const base::DictionaryValue* value;
   CHECK(value_in.GetAsDictionary(&value));
@@ -79,6 +89,61 @@ std::unique_ptr<base::Value> River::ToJson(const River& river) {
   return result;
 }
 
+void River::WriteJson(const River& river, JsonEncoder* encoder) {
+  encoder->BeginObject();
+  encoder->Key("source");
+  encoder->Int(river.source);
+  encoder->Key("target");
+  encoder->Int(river.target);
+  encoder->EndObject();
+}
+
+SiteIndexMap::SiteIndexMap() = default;
+SiteIndexMap::~SiteIndexMap() = default;
+
+void SiteIndexMap::Build(const std::vector<int>& site_ids) {
+  num_sites_ = site_ids.size();
+  table_.clear();
+  sparse_table_.clear();
+  if (site_ids.empty())
+    return;
+
+  auto minmax = std::minmax_element(site_ids.begin(), site_ids.end());
+  min_site_id_ = *minmax.first;
+  int64_t range = static_cast<int64_t>(*minmax.second) - min_site_id_ + 1;
+  if (range > static_cast<int64_t>(site_ids.size()) * 4 + 1024) {
+    sparse_table_.reserve(site_ids.size());
+    for (size_t i = 0; i < site_ids.size(); ++i) {
+      CHECK(sparse_table_.emplace(site_ids[i], static_cast<int>(i)).second)
+          << "Duplicated site: " << site_ids[i];
+    }
+    return;
+  }
+
+  table_.assign(range, -1);
+  for (size_t i = 0; i < site_ids.size(); ++i) {
+    int& index = table_[site_ids[i] - min_site_id_];
+    CHECK_EQ(-1, index) << "Duplicated site: " << site_ids[i];
+    index = static_cast<int>(i);
+  }
+}
+
+int SiteIndexMap::Get(int site_id) const {
+  int index = Find(site_id);
+  DCHECK_GE(index, 0) << "Unknown site: " << site_id;
+  return index;
+}
+
+void GameMap::BuildSiteIndex() {
+  std::sort(sites.begin(), sites.end(),
+            [](const Site& a, const Site& b) { return a.id < b.id; });
+  std::vector<int> site_ids;
+  site_ids.reserve(sites.size());
+  for (const Site& site : sites)
+    site_ids.push_back(site.id);
+  site_index_map.Build(site_ids);
+}
+
 GameMap GameMap::FromJson(const base::Value& value_in) {
   const base::DictionaryValue* value;
   CHECK(value_in.GetAsDictionary(&value));
@@ -94,6 +159,7 @@ GameMap GameMap::FromJson(const base::Value& value_in) {
   common::FromJson(*sites_value, &game_map.sites);
   common::FromJson(*rivers_value, &game_map.rivers);
   common::FromJson(*mines_value, &game_map.mines);
+  game_map.BuildSiteIndex();
   return game_map;
 }
 
@@ -105,6 +171,23 @@ std::unique_ptr<base::Value> GameMap::ToJson(const GameMap& game_map) {
   return result;
 }
 
+void GameMap::WriteJson(const GameMap& game_map, JsonEncoder* encoder) {
+  encoder->BeginObject();
+  encoder->Key("mines");
+  encoder->IntList(game_map.mines);
+  encoder->Key("rivers");
+  encoder->BeginArray();
+  for (const River& river : game_map.rivers)
+    River::WriteJson(river, encoder);
+  encoder->EndArray();
+  encoder->Key("sites");
+  encoder->BeginArray();
+  for (const Site& site : game_map.sites)
+    Site::WriteJson(site, encoder);
+  encoder->EndArray();
+  encoder->EndObject();
+}
+
 SetUpData SetUpData::FromJson(const base::Value& value_in) {
   const base::DictionaryValue* value;
   CHECK(value_in.GetAsDictionary(&value));
@@ -152,6 +235,34 @@ std::unique_ptr<base::Value> SetUpData::ToJson(const SetUpData& args) {
   return result;
 }
 
+void SetUpData::WriteJson(const SetUpData& args, JsonEncoder* encoder) {
+  encoder->BeginObject();
+  encoder->Key("map");
+  GameMap::WriteJson(args.game_map, encoder);
+  encoder->Key("punter");
+  encoder->Int(args.punter_id);
+  encoder->Key("punters");
+  encoder->Int(args.num_punters);
+  if (args.settings.futures || args.settings.splurges || args.settings.options) {
+    encoder->Key("settings");
+    encoder->BeginObject();
+    if (args.settings.futures) {
+      encoder->Key("futures");
+      encoder->Bool(true);
+    }
+    if (args.settings.options) {
+      encoder->Key("options");
+      encoder->Bool(true);
+    }
+    if (args.settings.splurges) {
+      encoder->Key("splurges");
+      encoder->Bool(true);
+    }
+    encoder->EndObject();
+  }
+  encoder->EndObject();
+}
+
 GameMove GameMove::Pass(int punter_id) {
   return {GameMove::Type::PASS, punter_id};
 }
@@ -244,6 +355,49 @@ std::unique_ptr<base::DictionaryValue> GameMove::ToJson(const GameMove& game_mov
   return {};
 }
 
+void GameMove::WriteJson(const GameMove& game_move, JsonEncoder* encoder) {
+  encoder->BeginObject();
+  WriteJsonMember(game_move, encoder);
+  encoder->EndObject();
+}
+
+void GameMove::WriteJsonMember(const GameMove& game_move,
+                               JsonEncoder* encoder) {
+  switch (game_move.type) {
+    case GameMove::Type::CLAIM:
+      encoder->Key("claim");
+      break;
+    case GameMove::Type::PASS:
+      encoder->Key("pass");
+      break;
+    case GameMove::Type::SPLURGE:
+      encoder->Key("splurge");
+      break;
+    case GameMove::Type::OPTION:
+      encoder->Key("option");
+      break;
+  }
+  encoder->BeginObject();
+  encoder->Key("punter");
+  encoder->Int(game_move.punter_id);
+  switch (game_move.type) {
+    case GameMove::Type::CLAIM:
+    case GameMove::Type::OPTION:
+      encoder->Key("source");
+      encoder->Int(game_move.source);
+      encoder->Key("target");
+      encoder->Int(game_move.target);
+      break;
+    case GameMove::Type::SPLURGE:
+      encoder->Key("route");
+      encoder->IntList(game_move.route);
+      break;
+    case GameMove::Type::PASS:
+      break;
+  }
+  encoder->EndObject();
+}
+
 std::vector<GameMove> GameMoves::FromJson(const base::ListValue& value) {
   std::vector<GameMove> result;
   common::FromJson(value, &result);
@@ -255,6 +409,14 @@ std::unique_ptr<base::Value> GameMoves::ToJson(
   return common::ToJson(moves);
 }
 
+void GameMoves::WriteJson(const std::vector<GameMove>& moves,
+                          JsonEncoder* encoder) {
+  encoder->BeginArray();
+  for (const GameMove& move : moves)
+    GameMove::WriteJson(move, encoder);
+  encoder->EndArray();
+}
+
 std::vector<Future> Futures::FromJson(const base::ListValue& value) {
   std::vector<Future> result;
   common::FromJson(value, &result);
@@ -266,4 +428,12 @@ std::unique_ptr<base::Value> Futures::ToJson(
   return common::ToJson(futures);
 }
 
+void Futures::WriteJson(const std::vector<Future>& futures,
+                        JsonEncoder* encoder) {
+  encoder->BeginArray();
+  for (const Future& future : futures)
+    River::WriteJson(future, encoder);
+  encoder->EndArray();
+}
+
 }  // namespace common
@@ -1,19 +1,28 @@
 #ifndef COMMON_GAME_DATA_H_
 #define COMMON_GAME_DATA_H_
 
+#include <stdint.h>
+
+#include <unordered_map>
 #include <vector>
 
 #include "base/values.h"
 
 namespace common {
 
+class JsonEncoder;
+
 std::unique_ptr<base::Value> ToJson(const std::vector<int>& elements);
 
+// The WriteJson() functions below write the same JSON as ToJson(), straight
+// into |encoder|.
+
 struct Site {
   int id;
 
   static Site FromJson(const base::Value& value);
   static std::unique_ptr<base::Value> ToJson(const Site& site);
+  static void WriteJson(const Site& site, JsonEncoder* encoder);
 };
 
 struct River {
@@ -22,15 +31,59 @@ struct River {
 
   static River FromJson(const base::Value& value);
   static std::unique_ptr<base::Value> ToJson(const River& river);
+  static void WriteJson(const River& river, JsonEncoder* encoder);
+};
+
+// Maps site ids to dense site indexes in O(1).
+class SiteIndexMap {
+ public:
+  SiteIndexMap();
+  ~SiteIndexMap();
+
+  // |site_ids| lists the id of each site index. Ids must be unique.
+  void Build(const std::vector<int>& site_ids);
+
+  // Returns the index of |site_id|, or -1 if there is no such site.
+  int Find(int site_id) const {
+    if (!sparse_table_.empty()) {
+      auto iter = sparse_table_.find(site_id);
+      return iter == sparse_table_.end() ? -1 : iter->second;
+    }
+    int64_t offset = static_cast<int64_t>(site_id) - min_site_id_;
+    if (offset < 0 || offset >= static_cast<int64_t>(table_.size()))
+      return -1;
+    return table_[offset];
+  }
+
+  // Same as Find(), but |site_id| must exist.
+  int Get(int site_id) const;
+
+  size_t size() const { return num_sites_; }
+
+ private:
+  size_t num_sites_ = 0;
+  int min_site_id_ = 0;
+  std::vector<int> table_;  // site_id - min_site_id_ -> index, or -1.
+  // Used instead of |table_| if the ids are too sparse.
+  std::unordered_map<int, int> sparse_table_;
 };
 
 struct GameMap {
+  // Sorted by id. The position of a site in |sites| is its site index, which
+  // is shared by the framework, the scorer and the referee.
   std::vector<Site> sites;
   std::vector<River> rivers;
   std::vector<int> mines;
+  SiteIndexMap site_index_map;
+
+  // Sorts |sites| and rebuilds |site_index_map|. FromJson() does this; call
+  // it again after filling |sites| by hand.
+  void BuildSiteIndex();
+  int GetSiteIndex(int site_id) const { return site_index_map.Get(site_id); }
 
   static GameMap FromJson(const base::Value& value);
   static std::unique_ptr<base::Value> ToJson(const GameMap& game_map);
+  static void WriteJson(const GameMap& game_map, JsonEncoder* encoder);
 };
 
 struct Settings {
@@ -47,6 +100,7 @@ struct SetUpData {
 
   static SetUpData FromJson(const base::Value& value);
   static std::unique_ptr<base::Value> ToJson(const SetUpData& set_up_data);
+  static void WriteJson(const SetUpData& set_up_data, JsonEncoder* encoder);
 };
 
 struct GameMove {
@@ -73,12 +127,18 @@ struct GameMove {
 
   static GameMove FromJson(const base::Value& value);
   static std::unique_ptr<base::DictionaryValue> ToJson(const GameMove& game_move);
+  static void WriteJson(const GameMove& game_move, JsonEncoder* encoder);
+  // Writes only the "claim" (etc.) member, into an object opened by the
+  // caller, for messages that carry more members.
+  static void WriteJsonMember(const GameMove& game_move, JsonEncoder* encoder);
 };
 
 struct GameMoves {
   static std::vector<GameMove> FromJson(const base::ListValue& value);
   static std::unique_ptr<base::Value> ToJson(
       const std::vector<GameMove>& moves);
+  static void WriteJson(const std::vector<GameMove>& moves,
+                        JsonEncoder* encoder);
 };
 
 using Future = River;
@@ -87,6 +147,8 @@ struct Futures {
   static std::vector<Future> FromJson(const base::ListValue& value);
   static std::unique_ptr<base::Value> ToJson(
       const std::vector<Future>& futures);
+  static void WriteJson(const std::vector<Future>& futures,
+                        JsonEncoder* encoder);
 };
 
 }  // namespace common
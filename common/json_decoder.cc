@@ -0,0 +1,480 @@
+#include "common/json_decoder.h"
+
+#include <string>
+
+#include "base/logging.h"
+#include "base/strings/string_number_conversions.h"
+#include "base/strings/utf_string_conversion_utils.h"
+#include "base/third_party/icu/icu_utf.h"
+
+namespace common {
+
+bool JsonDecoder::AtEnd() {
+  SkipSpace();
+  return p_ == end_;
+}
+
+bool JsonDecoder::ReadInt(int* value) {
+  SkipSpace();
+  const char* start = p_;
+  if (p_ < end_ && *p_ == '-')
+    ++p_;
+  while (p_ < end_ && '0' <= *p_ && *p_ <= '9')
+    ++p_;
+  // A fraction or an exponent makes it a double.
+  if (p_ < end_ && (*p_ == '.' || *p_ == 'e' || *p_ == 'E'))
+    return Fail();
+  return base::StringToInt(base::StringPiece(start, p_ - start), value) ||
+      Fail();
+}
+
+bool JsonDecoder::ReadBool(bool* value) {
+  if (ConsumeLiteral("true")) {
+    *value = true;
+    return true;
+  }
+  if (ConsumeLiteral("false")) {
+    *value = false;
+    return true;
+  }
+  return Fail();
+}
+
+bool JsonDecoder::ReadString(base::StringPiece* value, std::string* buffer) {
+  if (!Expect('"'))
+    return false;
+  const char* start = p_;
+  while (p_ < end_ && *p_ != '"' && *p_ != '\\')
+    ++p_;
+  if (p_ == end_)
+    return Fail();
+  if (*p_ == '"') {
+    *value = base::StringPiece(start, p_ - start);
+    ++p_;
+    return true;
+  }
+
+  buffer->assign(start, p_ - start);
+  while (p_ < end_ && *p_ != '"') {
+    if (*p_ != '\\') {
+      buffer->push_back(*p_++);
+      continue;
+    }
+    if (++p_ == end_)
+      return Fail();
+    switch (*p_++) {
+      case '"': buffer->push_back('"'); break;
+      case '\\': buffer->push_back('\\'); break;
+      case '/': buffer->push_back('/'); break;
+      case 'b': buffer->push_back('\b'); break;
+      case 'f': buffer->push_back('\f'); break;
+      case 'n': buffer->push_back('\n'); break;
+      case 'r': buffer->push_back('\r'); break;
+      case 't': buffer->push_back('\t'); break;
+      case 'u': {
+        uint32_t code_point;
+        if (!ReadCodePoint(&code_point))
+          return Fail();
+        base::WriteUnicodeCharacter(code_point, buffer);
+        break;
+      }
+      default:
+        return Fail();
+    }
+  }
+  if (p_ == end_)
+    return Fail();
+  ++p_;
+  *value = *buffer;
+  return true;
+}
+
+bool JsonDecoder::ReadCodeUnit(int* code_unit) {
+  if (end_ - p_ < 4 ||
+      !base::HexStringToInt(base::StringPiece(p_, 4), code_unit)) {
+    return Fail();
+  }
+  p_ += 4;
+  return true;
+}
+
+bool JsonDecoder::ReadCodePoint(uint32_t* code_point) {
+  int lead;
+  if (!ReadCodeUnit(&lead))
+    return false;
+  if (!CBU16_IS_SURROGATE(lead)) {
+    *code_point = lead;
+    return base::IsValidCharacter(*code_point) || Fail();
+  }
+
+  // As base::JSONReader, takes a lead surrogate only with a trail surrogate
+  // escaped right after it.
+  if (!CBU16_IS_SURROGATE_LEAD(lead) || end_ - p_ < 2 || p_[0] != '\\' ||
+      p_[1] != 'u') {
+    return Fail();
+  }
+  p_ += 2;
+  int trail;
+  if (!ReadCodeUnit(&trail) || !CBU16_IS_TRAIL(trail))
+    return Fail();
+  *code_point = CBU16_GET_SUPPLEMENTARY(lead, trail);
+  return base::IsValidCharacter(*code_point) || Fail();
+}
+
+bool JsonDecoder::SkipValue(base::StringPiece* text) {
+  SkipSpace();
+  const char* start = p_;
+  int depth = 0;
+  while (p_ < end_) {
+    const char c = *p_;
+    if (c == '"') {
+      if (!SkipString())
+        return false;
+    } else if (c == '{' || c == '[') {
+      ++depth;
+      ++p_;
+    } else if (c == '}' || c == ']') {
+      // At depth 0, this closes the enclosing value.
+      if (depth == 0)
+        break;
+      --depth;
+      ++p_;
+    } else if (depth == 0 && (c == ',' || IsSpace(c))) {
+      break;
+    } else {
+      ++p_;
+    }
+    if (depth == 0 && (c == '"' || c == '}' || c == ']'))
+      break;
+  }
+  if (p_ == start || depth != 0)
+    return Fail();
+  if (text)
+    *text = base::StringPiece(start, p_ - start);
+  return true;
+}
+
+void JsonDecoder::SkipSpace() {
+  while (p_ < end_ && IsSpace(*p_))
+    ++p_;
+}
+
+bool JsonDecoder::Consume(char c) {
+  SkipSpace();
+  if (p_ == end_ || *p_ != c)
+    return false;
+  ++p_;
+  return true;
+}
+
+bool JsonDecoder::ConsumeLiteral(base::StringPiece literal) {
+  SkipSpace();
+  if (static_cast<size_t>(end_ - p_) < literal.size() ||
+      base::StringPiece(p_, literal.size()) != literal) {
+    return false;
+  }
+  p_ += literal.size();
+  return true;
+}
+
+bool JsonDecoder::SkipString() {
+  for (++p_; p_ < end_; ++p_) {
+    if (*p_ == '\\') {
+      ++p_;
+    } else if (*p_ == '"') {
+      ++p_;
+      return true;
+    }
+  }
+  return Fail();
+}
+
+namespace {
+
+bool ReadIntList(JsonDecoder* decoder, std::vector<int>* values) {
+  return decoder->ReadArray([decoder, values]() {
+    values->emplace_back();
+    return decoder->ReadInt(&values->back());
+  });
+}
+
+bool ReadSite(JsonDecoder* decoder, Site* site) {
+  bool has_id = false;
+  return decoder->ReadObject([decoder, site, &has_id](base::StringPiece key) {
+    if (key == "id") {
+      has_id = true;
+      return decoder->ReadInt(&site->id);
+    }
+    return decoder->SkipValue(nullptr);
+  }) && has_id;
+}
+
+bool ReadRiver(JsonDecoder* decoder, River* river) {
+  int found = 0;
+  return decoder->ReadObject([decoder, river, &found](base::StringPiece key) {
+    if (key == "source") {
+      ++found;
+      return decoder->ReadInt(&river->source);
+    }
+    if (key == "target") {
+      ++found;
+      return decoder->ReadInt(&river->target);
+    }
+    return decoder->SkipValue(nullptr);
+  }) && found == 2;
+}
+
+bool ReadGameMap(JsonDecoder* decoder, GameMap* game_map) {
+  int found = 0;
+  bool ok = decoder->ReadObject([decoder, game_map, &found](
+      base::StringPiece key) {
+    if (key == "sites") {
+      ++found;
+      return decoder->ReadArray([decoder, game_map]() {
+        game_map->sites.emplace_back();
+        return ReadSite(decoder, &game_map->sites.back());
+      });
+    }
+    if (key == "rivers") {
+      ++found;
+      return decoder->ReadArray([decoder, game_map]() {
+        game_map->rivers.emplace_back();
+        return ReadRiver(decoder, &game_map->rivers.back());
+      });
+    }
+    if (key == "mines") {
+      ++found;
+      return ReadIntList(decoder, &game_map->mines);
+    }
+    return decoder->SkipValue(nullptr);
+  });
+  if (!ok || found != 3)
+    return false;
+  game_map->BuildSiteIndex();
+  return true;
+}
+
+bool ReadSettings(JsonDecoder* decoder, Settings* settings) {
+  return decoder->ReadObject([decoder, settings](base::StringPiece key) {
+    if (key == "futures")
+      return decoder->ReadBool(&settings->futures);
+    if (key == "splurges")
+      return decoder->ReadBool(&settings->splurges);
+    if (key == "options")
+      return decoder->ReadBool(&settings->options);
+    return decoder->SkipValue(nullptr);
+  });
+}
+
+// Reads the content of a move, e.g. {"punter": 0, "source": 1, ...}.
+bool ReadMoveContent(JsonDecoder* decoder, GameMove* move) {
+  bool has_punter = false;
+  int found = 0;
+  bool ok = decoder->ReadObject([decoder, move, &has_punter, &found](
+      base::StringPiece key) {
+    if (key == "punter") {
+      has_punter = true;
+      return decoder->ReadInt(&move->punter_id);
+    }
+    if (key == "source" && (move->type == GameMove::Type::CLAIM ||
+                            move->type == GameMove::Type::OPTION)) {
+      ++found;
+      return decoder->ReadInt(&move->source);
+    }
+    if (key == "target" && (move->type == GameMove::Type::CLAIM ||
+                            move->type == GameMove::Type::OPTION)) {
+      ++found;
+      return decoder->ReadInt(&move->target);
+    }
+    if (key == "route" && move->type == GameMove::Type::SPLURGE) {
+      ++found;
+      return ReadIntList(decoder, &move->route);
+    }
+    return decoder->SkipValue(nullptr);
+  });
+  int expected = 0;
+  switch (move->type) {
+    case GameMove::Type::CLAIM:
+    case GameMove::Type::OPTION:
+      expected = 2;
+      break;
+    case GameMove::Type::SPLURGE:
+      expected = 1;
+      break;
+    case GameMove::Type::PASS:
+      break;
+  }
+  return ok && has_punter && found == expected;
+}
+
+bool ReadGameMove(JsonDecoder* decoder, GameMove* move) {
+  bool found = false;
+  return decoder->ReadObject([decoder, move, &found](base::StringPiece key) {
+    if (key == "claim") {
+      move->type = GameMove::Type::CLAIM;
+    } else if (key == "pass") {
+      move->type = GameMove::Type::PASS;
+    } else if (key == "splurge") {
+      move->type = GameMove::Type::SPLURGE;
+    } else if (key == "option") {
+      move->type = GameMove::Type::OPTION;
+    } else {
+      return decoder->SkipValue(nullptr);
+    }
+    if (found)
+      return false;
+    found = true;
+    return ReadMoveContent(decoder, move);
+  }) && found;
+}
+
+bool ReadScore(JsonDecoder* decoder, ServerMessage::Score* score) {
+  int found = 0;
+  return decoder->ReadObject([decoder, score, &found](base::StringPiece key) {
+    if (key == "punter") {
+      ++found;
+      return decoder->ReadInt(&score->punter_id);
+    }
+    if (key == "score") {
+      ++found;
+      return decoder->ReadInt(&score->score);
+    }
+    return decoder->SkipValue(nullptr);
+  }) && found == 2;
+}
+
+// Reads {"moves": [...]} of a move message.
+bool ReadMove(JsonDecoder* decoder, ServerMessage* message) {
+  bool has_moves = false;
+  return decoder->ReadObject([decoder, message, &has_moves](
+      base::StringPiece key) {
+    if (key == "moves") {
+      has_moves = true;
+      return ReadGameMoves(decoder, &message->moves);
+    }
+    return decoder->SkipValue(nullptr);
+  }) && has_moves;
+}
+
+// Reads {"moves": [...], "scores": [...]} of a stop message.
+bool ReadStop(JsonDecoder* decoder, ServerMessage* message) {
+  int found = 0;
+  return decoder->ReadObject([decoder, message, &found](
+      base::StringPiece key) {
+    if (key == "moves") {
+      ++found;
+      return ReadGameMoves(decoder, &message->moves);
+    }
+    if (key == "scores") {
+      ++found;
+      return decoder->ReadArray([decoder, message]() {
+        message->scores.emplace_back();
+        return ReadScore(decoder, &message->scores.back());
+      });
+    }
+    return decoder->SkipValue(nullptr);
+  }) && found == 2;
+}
+
+}  // namespace
+
+bool ReadGameMoves(JsonDecoder* decoder, std::vector<GameMove>* moves) {
+  return decoder->ReadArray([decoder, moves]() {
+    moves->emplace_back();
+    return ReadGameMove(decoder, &moves->back());
+  });
+}
+
+bool DecodeServerMessage(base::StringPiece json, ServerMessage* message) {
+  JsonDecoder decoder(json);
+  bool has_punter = false;
+  bool has_punters = false;
+  bool has_map = false;
+  bool has_move = false;
+  bool has_stop = false;
+  message->set_up.settings = {false, false, false};
+  bool ok = decoder.ReadObject([&](base::StringPiece key) {
+    if (key == "punter") {
+      has_punter = true;
+      return decoder.ReadInt(&message->set_up.punter_id);
+    }
+    if (key == "punters") {
+      has_punters = true;
+      return decoder.ReadInt(&message->set_up.num_punters);
+    }
+    if (key == "map") {
+      has_map = true;
+      return ReadGameMap(&decoder, &message->set_up.game_map);
+    }
+    if (key == "settings")
+      return ReadSettings(&decoder, &message->set_up.settings);
+    if (key == "move") {
+      has_move = true;
+      return ReadMove(&decoder, message);
+    }
+    if (key == "stop") {
+      has_stop = true;
+      return ReadStop(&decoder, message);
+    }
+    if (key == "timeout_ms")
+      return decoder.ReadInt(&message->timeout_ms);
+    if (key == "state")
+      return decoder.SkipValue(&message->state);
+    return decoder.SkipValue(nullptr);
+  });
+  if (!ok || !decoder.AtEnd())
+    return false;
+
+  if (has_punter) {
+    message->type = ServerMessage::Type::SET_UP;
+    return has_punters && has_map;
+  }
+  if (has_stop) {
+    message->type = ServerMessage::Type::STOP;
+    return true;
+  }
+  message->type = ServerMessage::Type::MOVE;
+  return has_move;
+}
+
+bool DecodePunterMessage(base::StringPiece json, PunterMessage* message) {
+  JsonDecoder decoder(json);
+  bool has_ready = false;
+  bool has_move = false;
+  bool ok = decoder.ReadObject([&](base::StringPiece key) {
+    if (key == "ready") {
+      has_ready = true;
+      return decoder.ReadInt(&message->punter_id);
+    }
+    if (key == "futures") {
+      return decoder.ReadArray([&decoder, message]() {
+        message->futures.emplace_back();
+        return ReadRiver(&decoder, &message->futures.back());
+      });
+    }
+    if (key == "state")
+      return decoder.SkipValue(&message->state);
+    if (key == "claim") {
+      message->move.type = GameMove::Type::CLAIM;
+    } else if (key == "pass") {
+      message->move.type = GameMove::Type::PASS;
+    } else if (key == "splurge") {
+      message->move.type = GameMove::Type::SPLURGE;
+    } else if (key == "option") {
+      message->move.type = GameMove::Type::OPTION;
+    } else {
+      return decoder.SkipValue(nullptr);
+    }
+    if (has_move)
+      return false;
+    has_move = true;
+    return ReadMoveContent(&decoder, &message->move);
+  });
+  if (!ok || !decoder.AtEnd() || has_ready == has_move)
+    return false;
+  message->type = has_ready ?
+      PunterMessage::Type::READY : PunterMessage::Type::MOVE;
+  return true;
+}
+
+}  // namespace common
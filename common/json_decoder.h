@@ -0,0 +1,138 @@
+#ifndef COMMON_JSON_DECODER_H_
+#define COMMON_JSON_DECODER_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "base/strings/string_piece.h"
+#include "common/game_data.h"
+
+namespace common {
+
+// Pull parser over JSON text. Each Read*() consumes one value, and returns
+// false on error. The decoder is of no use after an error.
+class JsonDecoder {
+ public:
+  explicit JsonDecoder(base::StringPiece text)
+      : p_(text.data()), end_(text.data() + text.size()) {}
+
+  // Returns true if only whitespace is left.
+  bool AtEnd();
+
+  bool ReadInt(int* value);
+  bool ReadBool(bool* value);
+  // Points |value| into the text, or into |buffer| if the string has escapes.
+  bool ReadString(base::StringPiece* value, std::string* buffer);
+
+  // Skips a value of any type, and points |text| (if given) to it. Only the
+  // nesting is checked, so |text| may still be broken JSON.
+  bool SkipValue(base::StringPiece* text);
+
+  // Calls |member(key)| for each member of an object. |member| must read
+  // the value, and return false on error.
+  template <typename Callback>
+  bool ReadObject(const Callback& member) {
+    if (!Expect('{'))
+      return false;
+    if (Consume('}'))
+      return true;
+    std::string buffer;
+    do {
+      base::StringPiece key;
+      if (!ReadString(&key, &buffer) || !Expect(':') || !member(key))
+        return Fail();
+    } while (Consume(','));
+    return Expect('}');
+  }
+
+  // Calls |element()| for each element of an array. |element| must read the
+  // value, and return false on error.
+  template <typename Callback>
+  bool ReadArray(const Callback& element) {
+    if (!Expect('['))
+      return false;
+    if (Consume(']'))
+      return true;
+    do {
+      if (!element())
+        return Fail();
+    } while (Consume(','));
+    return Expect(']');
+  }
+
+ private:
+  static bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  void SkipSpace();
+  bool Consume(char c);
+  bool Expect(char c) { return Consume(c) || Fail(); }
+  bool ConsumeLiteral(base::StringPiece literal);
+  bool SkipString();
+  // Reads the four hex digits of a \u escape.
+  bool ReadCodeUnit(int* code_unit);
+  // Reads what follows "\u", with the second half of a surrogate pair.
+  bool ReadCodePoint(uint32_t* code_point);
+
+  // Marks the place of errors.
+  static bool Fail() { return false; }
+
+  const char* p_;
+  const char* const end_;
+};
+
+// Reads a list of moves, as in the "moves" of a move message.
+bool ReadGameMoves(JsonDecoder* decoder, std::vector<GameMove>* moves);
+
+// A message from the server to a punter, after the name exchange.
+struct ServerMessage {
+  enum class Type {
+    SET_UP,
+    MOVE,
+    STOP,
+  };
+
+  struct Score {
+    int punter_id;
+    int score;
+  };
+
+  Type type;
+  SetUpData set_up;  // SET_UP only.
+  std::vector<GameMove> moves;  // MOVE and STOP.
+  std::vector<Score> scores;  // STOP only.
+  int timeout_ms = -1;  // MOVE only; -1 if not given.
+  // Text of "state", pointing into the decoded text. Empty if not given.
+  base::StringPiece state;
+};
+
+// Decodes |json| straight into |message|, without building a base::Value
+// tree; only "state" is left as text. Returns false if |json| is broken or
+// lacks a required field. Unknown fields are skipped.
+bool DecodeServerMessage(base::StringPiece json, ServerMessage* message);
+
+// A reply from a punter to the server.
+struct PunterMessage {
+  enum class Type {
+    READY,
+    MOVE,
+  };
+
+  Type type;
+  int punter_id = -1;  // READY only.
+  std::vector<Future> futures;  // READY only; empty if not given.
+  GameMove move;  // MOVE only.
+  // Text of "state", pointing into the decoded text. Empty if not given.
+  base::StringPiece state;
+};
+
+// Same as DecodeServerMessage(), for the replies of punters. Lets wrappers
+// relay the state of the punters they run without parsing it.
+bool DecodePunterMessage(base::StringPiece json, PunterMessage* message);
+
+}  // namespace common
+
+#endif  // COMMON_JSON_DECODER_H_
@@ -0,0 +1,123 @@
+#include "common/json_decoder.h"
+
+#include <memory>
+#include <string>
+
+#include "base/json/json_reader.h"
+#include "base/values.h"
+#include "gtest/gtest.h"
+
+namespace common {
+namespace {
+
+// Decodes |json| as a single string, or returns false.
+bool DecodeString(const std::string& json, std::string* result) {
+  JsonDecoder decoder(json);
+  base::StringPiece value;
+  std::string buffer;
+  if (!decoder.ReadString(&value, &buffer) || !decoder.AtEnd())
+    return false;
+  value.CopyToString(result);
+  return true;
+}
+
+TEST(JsonDecoderTest, StringEscapes) {
+  const char* const kCases[] = {
+    "\"plain\"",
+    "\"\\\"\\\\\\/\\b\\f\\n\\r\\t\"",
+    "\"a\\u0041\\u00e9\\u3042\"",
+    // U+1F600, as a surrogate pair.
+    "\"\\ud83d\\ude00\"",
+    "\"x\\uD834\\uDD1Ey\"",
+  };
+  for (const char* json : kCases) {
+    SCOPED_TRACE(json);
+    std::string decoded;
+    ASSERT_TRUE(DecodeString(json, &decoded));
+    std::unique_ptr<base::Value> expected = base::JSONReader::Read(json);
+    ASSERT_TRUE(expected);
+    std::string expected_string;
+    ASSERT_TRUE(expected->GetAsString(&expected_string));
+    EXPECT_EQ(expected_string, decoded);
+  }
+}
+
+TEST(JsonDecoderTest, BrokenStrings) {
+  const char* const kCases[] = {
+    "\"unterminated",
+    "\"bad escape \\x\"",
+    "\"short \\u12\"",
+    "\"not hex \\u12g4\"",
+    // Unpaired surrogates.
+    "\"\\ud83d\"",
+    "\"\\ud83dx\"",
+    "\"\\ud83d\\u0041\"",
+    "\"\\ude00\"",
+  };
+  for (const char* json : kCases) {
+    SCOPED_TRACE(json);
+    std::string decoded;
+    EXPECT_FALSE(DecodeString(json, &decoded));
+    EXPECT_FALSE(base::JSONReader::Read(json));
+  }
+}
+
+TEST(JsonDecoderTest, ServerMessage) {
+  ServerMessage message;
+  ASSERT_TRUE(DecodeServerMessage(
+      "{\"move\":{\"moves\":[{\"claim\":{\"punter\":0,\"source\":1,"
+      "\"target\":2}},{\"pass\":{\"punter\":1}}]},"
+      "\"unknown\":[1,{\"a\":\"}\"}],\"state\":{\"x\":[1,2]},"
+      "\"timeout_ms\":500}",
+      &message));
+  EXPECT_EQ(ServerMessage::Type::MOVE, message.type);
+  ASSERT_EQ(2u, message.moves.size());
+  EXPECT_EQ(GameMove::Type::CLAIM, message.moves[0].type);
+  EXPECT_EQ(0, message.moves[0].punter_id);
+  EXPECT_EQ(1, message.moves[0].source);
+  EXPECT_EQ(2, message.moves[0].target);
+  EXPECT_EQ(GameMove::Type::PASS, message.moves[1].type);
+  EXPECT_EQ(1, message.moves[1].punter_id);
+  EXPECT_EQ("{\"x\":[1,2]}", message.state);
+  EXPECT_EQ(500, message.timeout_ms);
+}
+
+TEST(JsonDecoderTest, PunterMessage) {
+  PunterMessage message;
+  ASSERT_TRUE(DecodePunterMessage(
+      "{\"ready\":3,\"futures\":[{\"source\":1,\"target\":4}],"
+      "\"extra\":null,\"state\":\"s\"}",
+      &message));
+  EXPECT_EQ(PunterMessage::Type::READY, message.type);
+  EXPECT_EQ(3, message.punter_id);
+  ASSERT_EQ(1u, message.futures.size());
+  EXPECT_EQ(1, message.futures[0].source);
+  EXPECT_EQ(4, message.futures[0].target);
+  EXPECT_EQ("\"s\"", message.state);
+}
+
+TEST(JsonDecoderTest, BrokenMessages) {
+  const char* const kCases[] = {
+    "",
+    "[]",
+    "{\"move\":{\"moves\":[]}",
+    "{\"move\":{\"moves\":[]}} trailing",
+    "{\"move\":{\"moves\":[{\"claim\":{\"punter\":\"0\"}}]}}",
+    "{\"timeout_ms\":500}",
+    "{\"punter\":0,\"punters\":2}",
+  };
+  for (const char* json : kCases) {
+    SCOPED_TRACE(json);
+    ServerMessage message;
+    EXPECT_FALSE(DecodeServerMessage(json, &message));
+  }
+
+  // Neither or both of a ready and a move.
+  PunterMessage message;
+  EXPECT_FALSE(DecodePunterMessage("{\"state\":{}}", &message));
+  EXPECT_FALSE(DecodePunterMessage(
+      "{\"ready\":0,\"pass\":{\"punter\":0}}", &message));
+}
+
+}  // namespace
+}  // namespace common
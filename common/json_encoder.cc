@@ -0,0 +1,86 @@
+#include "common/json_encoder.h"
+
+#include <stdio.h>
+
+#include "base/json/json_writer.h"
+#include "base/json/string_escape.h"
+#include "base/logging.h"
+
+namespace common {
+
+JsonEncoder::JsonEncoder() = default;
+JsonEncoder::~JsonEncoder() = default;
+
+void JsonEncoder::BeginObject() {
+  Separate();
+  buffer_.push_back('{');
+}
+
+void JsonEncoder::EndObject() {
+  buffer_.push_back('}');
+}
+
+void JsonEncoder::BeginArray() {
+  Separate();
+  buffer_.push_back('[');
+}
+
+void JsonEncoder::EndArray() {
+  buffer_.push_back(']');
+}
+
+void JsonEncoder::Key(base::StringPiece key) {
+  Separate();
+  base::EscapeJSONString(key, true /* put_in_quotes */, &buffer_);
+  buffer_.push_back(':');
+}
+
+void JsonEncoder::Int(int value) {
+  Separate();
+  char digits[16];
+  int size = snprintf(digits, sizeof(digits), "%d", value);
+  buffer_.append(digits, size);
+}
+
+void JsonEncoder::Bool(bool value) {
+  Separate();
+  buffer_.append(value ? "true" : "false");
+}
+
+void JsonEncoder::String(base::StringPiece value) {
+  Separate();
+  base::EscapeJSONString(value, true /* put_in_quotes */, &buffer_);
+}
+
+void JsonEncoder::Null() {
+  Separate();
+  buffer_.append("null");
+}
+
+void JsonEncoder::IntList(const std::vector<int>& values) {
+  BeginArray();
+  for (int value : values)
+    Int(value);
+  EndArray();
+}
+
+void JsonEncoder::Value(const base::Value& value) {
+  std::string json;
+  CHECK(base::JSONWriter::Write(value, &json));
+  Raw(json);
+}
+
+void JsonEncoder::Raw(base::StringPiece json) {
+  Separate();
+  json.AppendToString(&buffer_);
+}
+
+void JsonEncoder::Separate() {
+  if (buffer_.empty())
+    return;
+  const char last = buffer_.back();
+  if (last != '{' && last != '[' && last != ':')
+    buffer_.push_back(',');
+}
+
+}  // namespace common
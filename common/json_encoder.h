@@ -0,0 +1,55 @@
+#ifndef COMMON_JSON_ENCODER_H_
+#define COMMON_JSON_ENCODER_H_
+
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/strings/string_piece.h"
+#include "base/values.h"
+
+namespace common {
+
+// Formats JSON text into a buffer, without building base::Value trees.
+// Commas are added as needed; the caller opens and closes objects and
+// arrays, and writes a Key() before each member. Members come out in the
+// order they are written. The writers in game_data.h write them sorted by
+// key, as base::JSONWriter does, so both give the same text.
+class JsonEncoder {
+ public:
+  JsonEncoder();
+  ~JsonEncoder();
+
+  const std::string& text() const { return buffer_; }
+  // Empties the buffer, keeping its memory for reuse.
+  void Clear() { buffer_.clear(); }
+
+  void BeginObject();
+  void EndObject();
+  void BeginArray();
+  void EndArray();
+  void Key(base::StringPiece key);
+
+  void Int(int value);
+  void Bool(bool value);
+  void String(base::StringPiece value);
+  void Null();
+  void IntList(const std::vector<int>& values);
+  // Writes |value| with base::JSONWriter.
+  void Value(const base::Value& value);
+  // Splices in |json|, which must be a whole JSON value.
+  void Raw(base::StringPiece json);
+
+ private:
+  // Adds a comma, unless a value or a key starts the current container, or
+  // a value follows its key.
+  void Separate();
+
+  std::string buffer_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsonEncoder);
+};
+
+}  // namespace common
+
+#endif  // COMMON_JSON_ENCODER_H_
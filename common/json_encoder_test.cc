@@ -0,0 +1,114 @@
+#include "common/json_encoder.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/json/json_reader.h"
+#include "base/json/json_writer.h"
+#include "base/memory/ptr_util.h"
+#include "common/game_data.h"
+#include "gtest/gtest.h"
+
+namespace common {
+namespace {
+
+std::string WriteWithJsonWriter(const base::Value& value) {
+  std::string json;
+  EXPECT_TRUE(base::JSONWriter::Write(value, &json));
+  return json;
+}
+
+TEST(JsonEncoderTest, Values) {
+  JsonEncoder encoder;
+  encoder.BeginObject();
+  encoder.Key("a");
+  encoder.Int(-12);
+  encoder.Key("b");
+  encoder.Bool(true);
+  encoder.Key("c");
+  encoder.Null();
+  encoder.Key("d");
+  encoder.BeginArray();
+  encoder.BeginArray();
+  encoder.EndArray();
+  encoder.BeginObject();
+  encoder.EndObject();
+  encoder.String("\"quoted\"\\\n\t\x01 </script> \xC3\xA9");
+  encoder.EndArray();
+  encoder.Key("e");
+  encoder.IntList({3, 1, 2});
+  encoder.Key("f");
+  encoder.IntList({});
+  encoder.EndObject();
+
+  base::DictionaryValue expected;
+  expected.SetInteger("a", -12);
+  expected.SetBoolean("b", true);
+  expected.Set("c", base::MakeUnique<base::Value>());
+  auto list = base::MakeUnique<base::ListValue>();
+  list->Append(base::MakeUnique<base::ListValue>());
+  list->Append(base::MakeUnique<base::DictionaryValue>());
+  list->AppendString("\"quoted\"\\\n\t\x01 </script> \xC3\xA9");
+  expected.Set("d", std::move(list));
+  expected.Set("e", ToJson(std::vector<int>({3, 1, 2})));
+  expected.Set("f", ToJson(std::vector<int>()));
+
+  EXPECT_EQ(WriteWithJsonWriter(expected), encoder.text());
+}
+
+TEST(JsonEncoderTest, ValueAndRaw) {
+  std::unique_ptr<base::Value> value =
+      base::JSONReader::Read("{\"z\":[1,{\"y\":\"x\"}],\"a\":null}");
+  ASSERT_TRUE(value);
+
+  JsonEncoder encoder;
+  encoder.BeginArray();
+  encoder.Value(*value);
+  encoder.Raw(WriteWithJsonWriter(*value));
+  encoder.EndArray();
+
+  base::ListValue expected;
+  expected.Append(value->CreateDeepCopy());
+  expected.Append(value->CreateDeepCopy());
+  EXPECT_EQ(WriteWithJsonWriter(expected), encoder.text());
+
+  encoder.Clear();
+  encoder.Int(1);
+  EXPECT_EQ("1", encoder.text());
+}
+
+TEST(JsonEncoderTest, GameData) {
+  SetUpData set_up;
+  set_up.punter_id = 1;
+  set_up.num_punters = 3;
+  for (int id : {7, 3, 5})
+    set_up.game_map.sites.push_back(Site{id});
+  set_up.game_map.rivers = {River{3, 5}, River{5, 7}, River{7, 3}};
+  set_up.game_map.mines = {5};
+  set_up.game_map.BuildSiteIndex();
+  set_up.settings = {true, false, true};
+
+  JsonEncoder encoder;
+  SetUpData::WriteJson(set_up, &encoder);
+  EXPECT_EQ(WriteWithJsonWriter(*SetUpData::ToJson(set_up)), encoder.text());
+
+  std::vector<int> route = {3, 5, 7};
+  std::vector<GameMove> moves = {
+    GameMove::Claim(0, 3, 5),
+    GameMove::Pass(1),
+    GameMove::Splurge(2, &route),
+    GameMove::Option(0, 5, 7),
+  };
+  encoder.Clear();
+  GameMoves::WriteJson(moves, &encoder);
+  EXPECT_EQ(WriteWithJsonWriter(*GameMoves::ToJson(moves)), encoder.text());
+
+  std::vector<Future> futures = {Future{5, 7}, Future{5, 3}};
+  encoder.Clear();
+  Futures::WriteJson(futures, &encoder);
+  EXPECT_EQ(WriteWithJsonWriter(*Futures::ToJson(futures)), encoder.text());
+}
+
+}  // namespace
+}  // namespace common
@@ -9,6 +9,7 @@
 
 #include "base/logging.h"
 #include "base/posix/eintr_wrapper.h"
+#include "common/protocol.h"
 
 namespace common {
 
@@ -71,7 +72,10 @@ Popen::Popen(const std::string& shell, bool kill_on_parent_death) {
   CHECK(stdout_read_);
 }
 
-Popen::~Popen() { Wait(); }
+Popen::~Popen() {
+  Wait();
+  DiscardReadBuffer(stdout_read_.get());
+}
 
 void Popen::Wait() {
   // Maybe we need to kill all decendants?
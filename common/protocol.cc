@@ -1,17 +1,24 @@
 #include "common/protocol.h"
 
-#include <vector>
+#include <errno.h>
+#include <string.h>
+#include <sys/uio.h>
 
-#include <sys/epoll.h>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
-#include "base/files/scoped_file.h"
 #include "base/json/json_reader.h"
 #include "base/json/json_writer.h"
 #include "base/logging.h"
+#include "base/memory/ptr_util.h"
 #include "base/posix/eintr_wrapper.h"
 #include "base/strings/string_number_conversions.h"
 #include "base/strings/string_piece.h"
+#include "base/synchronization/lock.h"
 #include "base/time/time.h"
+#include "common/json_encoder.h"
 
 DEFINE_bool(logprotocol, false, "Output message for debugging.");
 DEFINE_bool(logreadprotocol, false, "Output message for debugging.");
@@ -21,78 +28,174 @@ namespace common {
 
 namespace {
 
-class FdWaiter {
- public:
-  FdWaiter() = default;
-  ~FdWaiter() = default;
-
-  void Initialize(
-      int fd, const base::TimeDelta& timeout,
-      const base::TimeTicks& start_time) {
-    if (!timeout.is_zero()) {
-      CHECK(!start_time.is_null());
-      end_time_ = start_time + timeout;
-    }
-    fd_ = fd;
+// Longest "N:" header accepted.
+constexpr size_t kMaxHeaderSize = 11;
+// Bytes asked for by each read(2), at least.
+constexpr size_t kReadChunkSize = 64 * 1024;
 
-    epoll_fd_.reset(epoll_create1(0));
-    PCHECK(epoll_fd_.is_valid());
+// Reads "N:<body>" frames from a fd. Reads in large chunks into a buffer
+// kept between messages, so a message usually costs a single read(2), and
+// the bytes of the next message that come along are kept for it. A frame cut
+// by a timeout is kept too, and completed by the next read.
+class FrameReader {
+ public:
+  enum class Status {
+    FRAME,  // A whole frame is buffered.
+    NEED_MORE,
+    ERROR,  // Broken header.
+  };
 
-    struct epoll_event ev = {};
-    ev.events = EPOLLIN;
-    ev.data.fd = fd;
-    PCHECK(epoll_ctl(epoll_fd_.get(), EPOLL_CTL_ADD, fd, &ev) == 0);
-  }
+  explicit FrameReader(int fd) : fd_(fd) {}
+  ~FrameReader() = default;
 
-  bool Wait() {
-    const int kMaxEvents = 1;
-    struct epoll_event events[kMaxEvents];
+  int fd() const { return fd_; }
 
+  // Reads the next frame, waiting until |deadline| (null for no deadline),
+  // and points |body| into the buffer, valid until the next call. Returns
+  // false on timeout, EOF or a broken header.
+  bool Read(const base::TimeTicks& deadline, base::StringPiece* body) {
     while (true) {
-      int timeout_ms;
-      if (end_time_.is_null()) {
-        timeout_ms = -1;
-      } else {
-        timeout_ms = (end_time_ - base::TimeTicks::Now()).InMilliseconds();
-        if (timeout_ms <= 0) {
-          // Timed out.
+      switch (Parse(body)) {
+        case Status::FRAME:
+          return true;
+        case Status::ERROR:
           return false;
-        }
+        case Status::NEED_MORE:
+          break;
       }
-
-      int num_fds =
-          epoll_wait(epoll_fd_.get(), events, kMaxEvents, timeout_ms);
-      if (num_fds == -1) {
-        if (errno == EINTR)
-          continue;
-        NOTREACHED();
+      if (!waiter_) {
+        waiter_ = base::MakeUnique<FdWaiter>();
+        waiter_->Add(fd_);
+      }
+      if (waiter_->Wait(deadline).empty()) {
+        DLOG(INFO) << "Timeout during reading the message";
         return false;
       }
-      if (num_fds == 0) {
-        // EPOLL Timeout. Will return false in the above check in the next
-        // iteration.
-        continue;
+      if (!ReadAvailable())
+        return false;
+    }
+  }
+
+  // Drops the frame returned last, and looks for the next one in the buffer.
+  // On FRAME, points |body| into the buffer, valid until the next call.
+  Status Parse(base::StringPiece* body) {
+    begin_ += consumed_;
+    consumed_ = 0;
+
+    const char* header = buffer_.data() + begin_;
+    const size_t available = end_ - begin_;
+    const char* colon = static_cast<const char*>(
+        memchr(header, ':', std::min(available, kMaxHeaderSize)));
+    if (!colon) {
+      if (available >= kMaxHeaderSize) {
+        DLOG(ERROR) << "Unexpected message format.";
+        return Status::ERROR;
       }
+      needed_ = kMaxHeaderSize;
+      return Status::NEED_MORE;
+    }
 
-      CHECK_EQ(num_fds, 1);
-      CHECK_EQ(events[0].data.fd, fd_);
+    size_t size;
+    CHECK(base::StringToSizeT(
+        base::StringPiece(header, colon - header), &size))
+        << "Invalid JSON message header";
+    const size_t frame_size = colon - header + 1 + size;
+    if (available < frame_size) {
+      needed_ = frame_size;
+      return Status::NEED_MORE;
+    }
+    *body = base::StringPiece(colon + 1, size);
+    consumed_ = frame_size;
+    return Status::FRAME;
+  }
+
+  // Reads what is available now, with room for what the last Parse()
+  // needed. Call when the fd is readable. Returns false on EOF.
+  bool ReadAvailable() {
+    if (begin_ > 0) {
+      memmove(buffer_.data(), buffer_.data() + begin_, end_ - begin_);
+      end_ -= begin_;
+      begin_ = 0;
+    }
+    const size_t capacity = std::max(needed_, end_ + kReadChunkSize);
+    if (buffer_.size() < capacity)
+      buffer_.resize(capacity);
+
+    ssize_t result = HANDLE_EINTR(
+        read(fd_, buffer_.data() + end_, buffer_.size() - end_));
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
       return true;
+    PCHECK(result >= 0);
+    if (result == 0) {
+      DLOG(ERROR) << "Unexpected EOF";
+      return false;
     }
+    end_ += result;
+    return true;
   }
 
+  // Returns true if there are unread bytes in the buffer.
+  bool HasBufferedData() const { return end_ > begin_ + consumed_; }
+
  private:
-  base::ScopedFD epoll_fd_;
-  base::TimeTicks end_time_;
-  int fd_ = -1;
-  DISALLOW_COPY_AND_ASSIGN(FdWaiter);
+  const int fd_;
+  std::vector<char> buffer_;
+  // Unread bytes are [begin_, end_).
+  size_t begin_ = 0;
+  size_t end_ = 0;
+  // Size of the frame returned last, dropped by the next Parse().
+  size_t consumed_ = 0;
+  // Bytes from begin_ that the last Parse() needed.
+  size_t needed_ = 0;
+  // Watches fd_ alone, for Read().
+  std::unique_ptr<FdWaiter> waiter_;
+
+  DISALLOW_COPY_AND_ASSIGN(FrameReader);
 };
 
+base::Lock& GetFrameReaderLock() {
+  static base::Lock* lock = new base::Lock();
+  return *lock;
+}
+
+std::unordered_map<int, std::unique_ptr<FrameReader>>& GetFrameReaders() {
+  static auto* readers =
+      new std::unordered_map<int, std::unique_ptr<FrameReader>>();
+  return *readers;
+}
+
+// A fd is read by one thread at a time, so only the lookup is locked.
+FrameReader* GetFrameReader(int fd) {
+  base::AutoLock lock(GetFrameReaderLock());
+  std::unique_ptr<FrameReader>& reader = GetFrameReaders()[fd];
+  if (!reader)
+    reader = base::MakeUnique<FrameReader>(fd);
+  return reader.get();
+}
+
+std::unique_ptr<base::Value> ParseBody(base::StringPiece body) {
+  if (FLAGS_logprotocol || FLAGS_logreadprotocol)
+    LOG(INFO) << "read: " << body;
+  return base::JSONReader::Read(body);
+}
+
+base::TimeTicks GetDeadline(const base::TimeDelta& timeout,
+                            const base::TimeTicks& start_time) {
+  if (timeout.is_zero())
+    return base::TimeTicks();
+  CHECK(!start_time.is_null());
+  return start_time + timeout;
+}
+
 void WritePingInternal(
     FILE* fp, base::StringPiece field_name, const std::string& name) {
   DLOG(INFO) << "Sending name: " << name;
-  base::DictionaryValue ping;
-  ping.SetString(field_name, name);
-  WriteMessage(fp, ping);
+  JsonEncoder ping;
+  ping.BeginObject();
+  ping.Key(field_name);
+  ping.String(name);
+  ping.EndObject();
+  WriteMessage(fp, ping.text());
 }
 
 base::Optional<std::string> ReadPingInternal(
@@ -110,68 +213,158 @@ base::Optional<std::string> ReadPingInternal(
 std::unique_ptr<base::Value> ReadMessage(FILE* fp,
                                          const base::TimeDelta& timeout,
                                          const base::TimeTicks& start_time) {
-  int fd = fileno(fp);
-  FdWaiter waiter;
-  waiter.Initialize(fd, timeout, start_time);
-
-  size_t size;
-  {
-    char buf[16];
-    for (int pos = 0;; ++pos) {
-      if (!waiter.Wait()) {
-        DLOG(INFO) << "Timeout during reading the size of the message";
-        return nullptr;
-      }
-      ssize_t result = HANDLE_EINTR(read(fd, &buf[pos], 1));
-      if (result == 0) {
-        DLOG(ERROR) << "Unexpected EOF";
-        return nullptr;
-      }
-      if (buf[pos] == ':') {
-        buf[pos] = '\0';
-        CHECK(base::StringToSizeT(buf, &size));
-        break;
-      }
-      if (pos >= 10) {
-        DLOG(ERROR) << "Unexpected message format.";
-        return nullptr;
+  base::StringPiece body;
+  if (!GetFrameReader(fileno(fp))->Read(GetDeadline(timeout, start_time),
+                                        &body)) {
+    return nullptr;
+  }
+  return ParseBody(body);
+}
+
+bool ReadMessageText(FILE* fp,
+                     const base::TimeDelta& timeout,
+                     const base::TimeTicks& start_time,
+                     base::StringPiece* text) {
+  if (!GetFrameReader(fileno(fp))->Read(GetDeadline(timeout, start_time),
+                                        text)) {
+    return false;
+  }
+  if (FLAGS_logprotocol || FLAGS_logreadprotocol)
+    LOG(INFO) << "read: " << *text;
+  return true;
+}
+
+std::vector<base::Optional<std::string>> ReadMessageTexts(
+    FdWaiter* waiter,
+    const std::vector<FILE*>& fps,
+    const base::TimeDelta& timeout,
+    const base::TimeTicks& start_time,
+    std::vector<int>* closed_fds) {
+  const base::TimeTicks deadline = GetDeadline(timeout, start_time);
+  std::vector<base::Optional<std::string>> result(fps.size());
+  std::unordered_map<int, FrameReader*> readers;
+  std::vector<size_t> pending;
+  bool closed = false;
+  for (size_t i = 0; i < fps.size(); ++i) {
+    FrameReader* reader = GetFrameReader(fileno(fps[i]));
+    readers[reader->fd()] = reader;
+    pending.push_back(i);
+  }
+
+  while (true) {
+    std::vector<size_t> still_pending;
+    for (size_t i : pending) {
+      base::StringPiece body;
+      switch (readers[fileno(fps[i])]->Parse(&body)) {
+        case FrameReader::Status::FRAME:
+          if (FLAGS_logprotocol || FLAGS_logreadprotocol)
+            LOG(INFO) << "read: " << body;
+          // Copy now; reading ahead on this fd may move the buffer.
+          result[i] = body.as_string();
+          break;
+        case FrameReader::Status::ERROR:
+          break;
+        case FrameReader::Status::NEED_MORE:
+          still_pending.push_back(i);
+          break;
       }
     }
-  }
-  CHECK(size >= 0) << "Invalid JSON message header";
+    pending.swap(still_pending);
+    if (pending.empty() || closed)
+      break;
 
-  std::vector<char> buf(size, 'x');
-  for (size_t filled = 0; filled < size; ) {
-    if (!waiter.Wait()) {
-      DLOG(INFO) << "Timeout during reading the body of the message";
-      return nullptr;
+    std::vector<int> ready_fds = waiter->Wait(deadline);
+    if (ready_fds.empty()) {
+      DLOG(INFO) << "Timeout during reading messages";
+      break;
     }
-    ssize_t result =
-        HANDLE_EINTR(read(fd, buf.data() + filled, size - filled));
-    PCHECK(result >= 0);
-    if (result == 0) {
-      DLOG(ERROR) << "Unexpected EOF";
-      return nullptr;
+    for (int fd : ready_fds) {
+      auto iter = readers.find(fd);
+      // Not ours, or done with: keep the bytes for the next read.
+      FrameReader* reader = iter != readers.end() ?
+          iter->second : GetFrameReader(fd);
+      // A closed fd stays ready until the owner of |waiter| removes it, so
+      // finish the frames at hand and stop.
+      if (!reader->ReadAvailable()) {
+        closed_fds->push_back(fd);
+        closed = true;
+      }
     }
-    filled += result;
   }
-  if (FLAGS_logprotocol || FLAGS_logreadprotocol)
-    LOG(INFO) << "read: " << std::string(buf.data(), buf.size());
-  return base::JSONReader::Read(base::StringPiece(buf.data(), buf.size()));
+  return result;
+}
+
+std::vector<std::unique_ptr<base::Value>> ReadMessages(
+    FdWaiter* waiter,
+    const std::vector<FILE*>& fps,
+    const base::TimeDelta& timeout,
+    const base::TimeTicks& start_time,
+    std::vector<int>* closed_fds) {
+  std::vector<base::Optional<std::string>> texts =
+      ReadMessageTexts(waiter, fps, timeout, start_time, closed_fds);
+  std::vector<std::unique_ptr<base::Value>> result(texts.size());
+  for (size_t i = 0; i < texts.size(); ++i) {
+    if (texts[i])
+      result[i] = base::JSONReader::Read(texts[i].value());
+  }
+  return result;
 }
 
 std::unique_ptr<base::Value> ReadMessage(FILE* fp) {
   return ReadMessage(fp, base::TimeDelta(), base::TimeTicks());
 }
 
+void WaitForMessage(FILE* fp) {
+  FrameReader* reader = GetFrameReader(fileno(fp));
+  if (reader->HasBufferedData())
+    return;
+  FdWaiter waiter;
+  waiter.Add(fileno(fp));
+  waiter.Wait(base::TimeTicks());
+}
+
+void DiscardReadBuffer(FILE* fp) {
+  base::AutoLock lock(GetFrameReaderLock());
+  GetFrameReaders().erase(fileno(fp));
+}
+
 void WriteMessage(FILE* fp, const base::Value& value) {
   std::string text;
   CHECK(base::JSONWriter::Write(value, &text));
+  WriteMessage(fp, base::StringPiece(text));
+}
+
+void WriteMessage(FILE* fp, base::StringPiece json) {
   if (FLAGS_logprotocol || FLAGS_logwriteprotocol)
-    LOG(INFO) << "write: " << text;
-  fprintf(fp, "%d:", static_cast<int>(text.size()));
-  CHECK_EQ(text.size(), fwrite(text.c_str(), 1, text.size(), fp));
+    LOG(INFO) << "write: " << json;
+  // Writes to the fd directly; make sure nothing is left behind in |fp|.
   fflush(fp);
+
+  char header[16];
+  int header_size =
+      snprintf(header, sizeof(header), "%d:", static_cast<int>(json.size()));
+  struct iovec iov[2];
+  iov[0].iov_base = header;
+  iov[0].iov_len = header_size;
+  iov[1].iov_base = const_cast<char*>(json.data());
+  iov[1].iov_len = json.size();
+  struct iovec* pending = iov;
+  int num_pending = 2;
+  while (num_pending > 0) {
+    ssize_t result = HANDLE_EINTR(writev(fileno(fp), pending, num_pending));
+    PCHECK(result >= 0);
+    // Skip what was written, in case of a short write.
+    size_t written = result;
+    while (num_pending > 0 && written >= pending->iov_len) {
+      written -= pending->iov_len;
+      ++pending;
+      --num_pending;
+    }
+    if (num_pending > 0) {
+      pending->iov_base = static_cast<char*>(pending->iov_base) + written;
+      pending->iov_len -= written;
+    }
+  }
 }
 
 void WritePing(FILE* fp, const std::string& name) {
@@ -4,9 +4,13 @@
 #include <stdio.h>
 
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "base/optional.h"
+#include "base/strings/string_piece.h"
 #include "base/values.h"
+#include "common/fd_waiter.h"
 
 namespace base {
   class TimeTicks;
@@ -22,7 +26,47 @@ std::unique_ptr<base::Value> ReadMessage(FILE* fp,
 // Recieve a message without timeout.
 std::unique_ptr<base::Value> ReadMessage(FILE* fp);
 
+// Same as ReadMessage(), but returns the text of the message in |text|,
+// valid until the next read from |fp|. Returns false on timeout or EOF.
+bool ReadMessageText(FILE* fp,
+                     const base::TimeDelta& timeout,
+                     const base::TimeTicks& start_time,
+                     base::StringPiece* text);
+
+// Reads one message from each of |fps| at the same time. |waiter| must watch
+// all of them; it may watch other fds too, whose bytes are kept for later.
+// The result for a fp is null if its message is not complete by the timeout
+// (a zero |timeout| means none), or on EOF.
+// Returns early when a fd watched by |waiter| is closed, after appending it
+// to |closed_fds|. The caller must remove it from |waiter|, which would
+// otherwise report it as ready forever, and may read again for the rest.
+std::vector<std::unique_ptr<base::Value>> ReadMessages(
+    FdWaiter* waiter,
+    const std::vector<FILE*>& fps,
+    const base::TimeDelta& timeout,
+    const base::TimeTicks& start_time,
+    std::vector<int>* closed_fds);
+
+// Same as ReadMessages(), but returns the text of each message, e.g. to
+// relay parts of it without parsing.
+std::vector<base::Optional<std::string>> ReadMessageTexts(
+    FdWaiter* waiter,
+    const std::vector<FILE*>& fps,
+    const base::TimeDelta& timeout,
+    const base::TimeTicks& start_time,
+    std::vector<int>* closed_fds);
+
+// Blocks until there is something for ReadMessage(fp) to read.
+void WaitForMessage(FILE* fp);
+
+// ReadMessage() keeps the bytes read ahead from each fd for the next call.
+// Drops them for |fp|; must be called before |fp| is closed, since its fd
+// may be reused.
+void DiscardReadBuffer(FILE* fp);
+
 void WriteMessage(FILE* fp, const base::Value& value);
+// Writes |json| as a message, header and body in a single writev(2).
+void WriteMessage(FILE* fp, base::StringPiece json);
 
 void WritePing(FILE* fp, const std::string& name);
 base::Optional<std::string> ReadPing(FILE* fp);
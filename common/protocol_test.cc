@@ -0,0 +1,184 @@
+#include "common/protocol.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/time/time.h"
+#include "gtest/gtest.h"
+
+namespace common {
+namespace {
+
+constexpr base::TimeDelta kShortTimeout =
+    base::TimeDelta::FromMilliseconds(50);
+
+// A pipe, read through the protocol functions and written to with raw
+// write(2) calls, so that the test controls how frames are split.
+class Pipe {
+ public:
+  Pipe() {
+    int fds[2];
+    EXPECT_EQ(0, pipe(fds));
+    read_ = fdopen(fds[0], "r");
+    write_fd_ = fds[1];
+  }
+
+  ~Pipe() {
+    DiscardReadBuffer(read_);
+    fclose(read_);
+    CloseWrite();
+  }
+
+  FILE* read() { return read_; }
+  int read_fd() { return fileno(read_); }
+
+  void Write(const std::string& bytes) {
+    size_t written = 0;
+    while (written < bytes.size()) {
+      ssize_t result = ::write(write_fd_, bytes.data() + written,
+                               bytes.size() - written);
+      ASSERT_GT(result, 0);
+      written += result;
+    }
+  }
+
+  void CloseWrite() {
+    if (write_fd_ >= 0)
+      close(write_fd_);
+    write_fd_ = -1;
+  }
+
+ private:
+  FILE* read_;
+  int write_fd_;
+};
+
+// Reads a message from |fp|, or returns "(none)" on timeout or EOF.
+std::string Read(FILE* fp) {
+  base::StringPiece text;
+  if (!ReadMessageText(fp, kShortTimeout, base::TimeTicks::Now(), &text))
+    return "(none)";
+  return text.as_string();
+}
+
+TEST(ProtocolTest, SeveralFramesInOneWrite) {
+  Pipe pipe;
+  pipe.Write("3:abc5:hello2:{}");
+  EXPECT_EQ("abc", Read(pipe.read()));
+  EXPECT_EQ("hello", Read(pipe.read()));
+  EXPECT_EQ("{}", Read(pipe.read()));
+  EXPECT_EQ("(none)", Read(pipe.read()));
+}
+
+TEST(ProtocolTest, PartialFrames) {
+  Pipe pipe;
+  // Split in the header.
+  pipe.Write("1");
+  EXPECT_EQ("(none)", Read(pipe.read()));
+  pipe.Write("1:{\"a\":");
+  // Split in the body.
+  EXPECT_EQ("(none)", Read(pipe.read()));
+  pipe.Write("12345}4:n");
+  EXPECT_EQ("{\"a\":12345}", Read(pipe.read()));
+  EXPECT_EQ("(none)", Read(pipe.read()));
+  pipe.Write("ull");
+  EXPECT_EQ("null", Read(pipe.read()));
+}
+
+TEST(ProtocolTest, FrameLargerThanPipe) {
+  Pipe pipe;
+  const std::string body(300 * 1000, 'x');
+  std::thread writer([&pipe, &body]() {
+    pipe.Write(std::to_string(body.size()) + ":" + body + "2:ok");
+  });
+  base::StringPiece text;
+  ASSERT_TRUE(ReadMessageText(pipe.read(), base::TimeDelta(),
+                              base::TimeTicks(), &text));
+  EXPECT_EQ(body, text);
+  writer.join();
+  EXPECT_EQ("ok", Read(pipe.read()));
+}
+
+TEST(ProtocolTest, EndOfFile) {
+  Pipe pipe;
+  pipe.Write("5:abc");
+  pipe.CloseWrite();
+  EXPECT_EQ("(none)", Read(pipe.read()));
+}
+
+TEST(ProtocolTest, ReadMessageTexts) {
+  Pipe pipe1;
+  Pipe pipe2;
+  Pipe other;
+  FdWaiter waiter;
+  waiter.Add(pipe1.read_fd());
+  waiter.Add(pipe2.read_fd());
+  waiter.Add(other.read_fd());
+
+  // Bytes for a fd that is not read are kept for later.
+  other.Write("5:other");
+  pipe1.Write("3:one3:two");
+  pipe2.Write("5:th");
+  std::thread writer([&pipe2]() { pipe2.Write("ree"); });
+  std::vector<int> closed_fds;
+  std::vector<base::Optional<std::string>> texts = ReadMessageTexts(
+      &waiter, {pipe1.read(), pipe2.read()}, base::TimeDelta(),
+      base::TimeTicks(), &closed_fds);
+  writer.join();
+  ASSERT_EQ(2u, texts.size());
+  EXPECT_EQ("one", texts[0].value_or("(none)"));
+  EXPECT_EQ("three", texts[1].value_or("(none)"));
+  EXPECT_TRUE(closed_fds.empty());
+
+  // The second frame of pipe1 is already buffered; pipe2 times out.
+  texts = ReadMessageTexts(&waiter, {pipe1.read(), pipe2.read()},
+                           kShortTimeout, base::TimeTicks::Now(),
+                           &closed_fds);
+  EXPECT_EQ("two", texts[0].value_or("(none)"));
+  EXPECT_FALSE(texts[1]);
+  EXPECT_TRUE(closed_fds.empty());
+  EXPECT_EQ("other", Read(other.read()));
+
+  // A closed fd is reported, and left in the waiter for the caller.
+  pipe1.CloseWrite();
+  texts = ReadMessageTexts(&waiter, {pipe1.read(), pipe2.read()},
+                           base::TimeDelta(), base::TimeTicks(),
+                           &closed_fds);
+  EXPECT_FALSE(texts[0]);
+  EXPECT_FALSE(texts[1]);
+  EXPECT_EQ(std::vector<int>({pipe1.read_fd()}), closed_fds);
+  waiter.Remove(pipe1.read_fd());
+
+  closed_fds.clear();
+  pipe2.Write("4:four");
+  texts = ReadMessageTexts(&waiter, {pipe2.read()}, base::TimeDelta(),
+                           base::TimeTicks(), &closed_fds);
+  EXPECT_EQ("four", texts[0].value_or("(none)"));
+  EXPECT_TRUE(closed_fds.empty());
+  waiter.Remove(pipe2.read_fd());
+  waiter.Remove(other.read_fd());
+}
+
+TEST(ProtocolTest, RegularFile) {
+  FILE* fp = tmpfile();
+  ASSERT_TRUE(fp);
+  ASSERT_GE(fputs("4:file", fp), 0);
+  ASSERT_EQ(0, fflush(fp));
+  ASSERT_EQ(0, lseek(fileno(fp), 0, SEEK_SET));
+
+  // epoll does not take regular files; they are always ready.
+  FdWaiter waiter;
+  waiter.Add(fileno(fp));
+  EXPECT_EQ(std::vector<int>({fileno(fp)}), waiter.Wait(base::TimeTicks()));
+  EXPECT_EQ("file", Read(fp));
+  waiter.Remove(fileno(fp));
+  DiscardReadBuffer(fp);
+  fclose(fp);
+}
+
+}  // namespace
+}  // namespace common
@@ -1,154 +1,411 @@
 #include "common/scorer.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include <stdint.h>
+
 #include <algorithm>
 #include <utility>
-#include <queue>
 
 #include "base/logging.h"
 #include "base/memory/ptr_util.h"
-#include "base/optional.h"
 #include "common/scorer.pb.h"
 
 namespace common {
 
 namespace {
 
-void CreateSiteIdList(const std::vector<Site>& sites,
-                      ::google::protobuf::RepeatedField<int>* output) {
-  output->Reserve(sites.size());
+std::vector<int> CreateSiteIdList(const std::vector<Site>& sites) {
+  std::vector<int> output;
+  output.reserve(sites.size());
   for (const auto& site : sites) {
-    output->Add(site.id);
+    output.push_back(site.id);
   }
-  std::sort(output->begin(), output->end());
+  DCHECK(std::is_sorted(output.begin(), output.end()));
+  return output;
 }
 
-// site_id_list must be sorted array.
-int GetIndex(const ::google::protobuf::RepeatedField<int>& sorted_container,
-             int value) {
+// sorted_container must be sorted array.
+int GetIndex(const std::vector<int>& sorted_container, int value) {
   auto it = std::lower_bound(
       sorted_container.begin(), sorted_container.end(), value);
   DCHECK_EQ(*it, value);
   return static_cast<int>(std::distance(sorted_container.begin(), it));
 }
 
-void CreateMineIndexList(
-    const std::vector<int>& mines,
-    const ::google::protobuf::RepeatedField<int>& site_id_list,
-    ::google::protobuf::RepeatedField<int>* output) {
-  output->Reserve(mines.size());
+std::vector<int> CreateMineIndexList(
+    const std::vector<int>& mines, const SiteIndexMap& site_index_map) {
+  std::vector<int> output;
+  output.reserve(mines.size());
   for (int mine : mines) {
-    output->Add(GetIndex(site_id_list, mine));
+    output.push_back(site_index_map.Get(mine));
   }
-  std::sort(output->begin(), output->end());
+  std::sort(output.begin(), output.end());
+  return output;
 }
 
-std::vector<std::pair<int, int>> CreateBidirectionalGraph(
-    const std::vector<River>& rivers,
-    const ::google::protobuf::RepeatedField<int>& site_id_list) {
-  std::vector<std::pair<int, int>> result;
+// Undirected adjacency of the map in compressed sparse row form: neighbors of
+// site i are neighbors[offsets[i]] .. neighbors[offsets[i + 1] - 1].
+struct Adjacency {
+  std::vector<int> offsets;
+  std::vector<int> neighbors;
+};
+
+Adjacency CreateAdjacency(
+    const std::vector<River>& rivers, const SiteIndexMap& site_index_map) {
+  Adjacency result;
+  result.offsets.assign(site_index_map.size() + 1, 0);
+  std::vector<std::pair<int, int>> edges;
+  edges.reserve(rivers.size());
   for (const auto& river : rivers) {
-    int source = GetIndex(site_id_list, river.source);
-    int target = GetIndex(site_id_list, river.target);
-    result.emplace_back(source, target);
-    result.emplace_back(target, source);
+    int source = site_index_map.Get(river.source);
+    int target = site_index_map.Get(river.target);
+    edges.emplace_back(source, target);
+    ++result.offsets[source + 1];
+    ++result.offsets[target + 1];
+  }
+  for (size_t i = 1; i < result.offsets.size(); ++i)
+    result.offsets[i] += result.offsets[i - 1];
+
+  result.neighbors.resize(result.offsets.back());
+  std::vector<int> cursor(result.offsets.begin(), result.offsets.end() - 1);
+  for (const auto& edge : edges) {
+    result.neighbors[cursor[edge.first]++] = edge.second;
+    result.neighbors[cursor[edge.second]++] = edge.first;
   }
-  std::sort(result.begin(), result.end());
   return result;
 }
 
-class DistanceMap {
+void AppendToRepeatedField(const int* begin, const int* end,
+                           ::google::protobuf::RepeatedField<int>* output) {
+  output->Reserve(output->size() + (end - begin));
+  for (; begin != end; ++begin)
+    output->AddAlreadyReserved(*begin);
+}
+
+// dst[i] += src[i] for i in [0, size).
+void AddScores(const int* src, size_t size, int* dst) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= size; i += 8) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_add_epi32(a, b));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 4 <= size; i += 4) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi32(a, b));
+  }
+#endif
+  for (; i < size; ++i)
+    dst[i] += src[i];
+}
+
+// dst[i] -= src[i] for i in [0, size).
+void SubtractScores(const int* src, size_t size, int* dst) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  for (; i + 8 <= size; i += 8) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i),
+                        _mm256_sub_epi32(a, b));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 4 <= size; i += 4) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_sub_epi32(a, b));
+  }
+#endif
+  for (; i < size; ++i)
+    dst[i] -= src[i];
+}
+
+// Markers in the one-byte distance encoding of DistanceMap.
+const uint8_t kUnreachableDistance = 0xFE;
+const uint8_t kOverflowDistance = 0xFF;
+
+}  // namespace
+
+// Distances from each mine, one byte per site. Distances that do not fit are
+// escaped to a sorted overflow list. Each mine is computed on first use,
+// together with the other mines of its batch of 64.
+class Scorer::DistanceMap {
  public:
-  explicit DistanceMap(DistanceMapProto* proto) : proto_(proto) {}
+  DistanceMap() = default;
 
   void Initialize(const GameMap& game_map,
-                  const ::google::protobuf::RepeatedField<int>& site_id_list,
-                  const ::google::protobuf::RepeatedField<int>& mine_list) {
-    std::vector<std::pair<int, int>> edges =
-        CreateBidirectionalGraph(game_map.rivers, site_id_list);
-
-    for (int i = 0; i < mine_list.size(); ++i) {
-      int mine_site_index = mine_list[i];
-      auto* dist_map = proto_->add_entries();
-
-      // Initialize as unreached.
-      dist_map->mutable_distance()->Resize(site_id_list.size(), -1);
-      dist_map->set_distance(mine_site_index, 0);
-
-      std::queue<int> q;
-      q.push(mine_site_index);
-      while (!q.empty()) {
-        int site_index = q.front();
-        q.pop();
-        int dist = dist_map->distance(site_index);
-        DCHECK_GE(dist, 0);
-
-        for (auto range = std::equal_range(
-                 edges.begin(), edges.end(),
-                 std::make_pair(site_index, 0),
-                 [](const std::pair<int, int>& a,
-                    const std::pair<int, int>& b) {
-                   return a.first < b.first;
-                 });
-             range.first != range.second; ++range.first) {
-          int next_site_index = range.first->second;
-          if (dist_map->distance(next_site_index) >= 0)
-            continue;
-          dist_map->set_distance(next_site_index, dist + 1);
-          q.push(next_site_index);
-        }
+                  const std::vector<int>& mine_list) {
+    num_sites_ = game_map.sites.size();
+    mine_list_ = mine_list;
+    adjacency_ = CreateAdjacency(game_map.rivers, game_map.site_index_map);
+    entries_.clear();
+    entries_.resize(mine_list_.size());
+  }
+
+  void Load(const DistanceMapProto& proto,
+            const std::vector<int>& mine_list,
+            size_t num_sites) {
+    num_sites_ = num_sites;
+    mine_list_ = mine_list;
+    adjacency_.offsets.assign(
+        proto.adjacency_offsets().begin(), proto.adjacency_offsets().end());
+    adjacency_.neighbors.assign(
+        proto.adjacency_neighbors().begin(),
+        proto.adjacency_neighbors().end());
+    DCHECK_EQ(mine_list_.size(), static_cast<size_t>(proto.entries_size()));
+    entries_.clear();
+    entries_.resize(mine_list_.size());
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      const DistanceMapEntryProto& entry_proto = proto.entries(i);
+      if (!entry_proto.has_distance())
+        continue;
+      Entry& entry = entries_[i];
+      const std::string& distance = entry_proto.distance();
+      DCHECK_EQ(num_sites_, distance.size());
+      entry.distance.assign(distance.begin(), distance.end());
+      DCHECK_EQ(entry_proto.overflow_site_index_size(),
+                entry_proto.overflow_distance_size());
+      for (int j = 0; j < entry_proto.overflow_site_index_size(); ++j) {
+        entry.overflow.emplace_back(entry_proto.overflow_site_index(j),
+                                    entry_proto.overflow_distance(j));
       }
     }
   }
 
-  int mine_size() const {
-    return proto_->entries_size();
+  void Save(DistanceMapProto* proto) const {
+    proto->Clear();
+    AppendToRepeatedField(
+        adjacency_.offsets.data(),
+        adjacency_.offsets.data() + adjacency_.offsets.size(),
+        proto->mutable_adjacency_offsets());
+    AppendToRepeatedField(
+        adjacency_.neighbors.data(),
+        adjacency_.neighbors.data() + adjacency_.neighbors.size(),
+        proto->mutable_adjacency_neighbors());
+    for (const auto& entry : entries_) {
+      DistanceMapEntryProto* entry_proto = proto->add_entries();
+      if (entry.distance.empty())
+        continue;
+      entry_proto->set_distance(
+          reinterpret_cast<const char*>(entry.distance.data()),
+          entry.distance.size());
+      for (const auto& overflow : entry.overflow) {
+        entry_proto->add_overflow_site_index(overflow.first);
+        entry_proto->add_overflow_distance(overflow.second);
+      }
+    }
   }
+
+  size_t mine_size() const { return mine_list_.size(); }
+
+  // Returns -1 if the site is not reachable from the mine.
   int GetDistance(int mine_index, int site_index) const {
-    return proto_->entries(mine_index).distance(site_index);
+    const Entry& entry = entries_[mine_index];
+    if (entry.distance.empty())
+      ComputeBatch(mine_index);
+    uint8_t distance = entry.distance[site_index];
+    if (distance < kUnreachableDistance)
+      return distance;
+    if (distance == kUnreachableDistance)
+      return -1;
+    auto it = std::lower_bound(entry.overflow.begin(), entry.overflow.end(),
+                               std::make_pair(site_index, 0));
+    DCHECK(it != entry.overflow.end() && it->first == site_index);
+    return it->second;
   }
 
  private:
-  DistanceMapProto* proto_;
+  struct Entry {
+    // site_index -> distance, or one of the markers above. Empty until
+    // computed.
+    std::vector<uint8_t> distance;
+    // (site_index, distance) for kOverflowDistance sites, sorted.
+    std::vector<std::pair<int, int>> overflow;
+  };
+
+  // BFS from the (up to) 64 mines in the batch of |mine_index| at once. Bit j
+  // of a site's mask stands for mine (base + j), so one pass over the
+  // frontier advances every mine in the batch by one level.
+  void ComputeBatch(int mine_index) const {
+    size_t base = mine_index & ~63;
+    size_t batch_size = std::min<size_t>(64, mine_list_.size() - base);
+    for (size_t j = 0; j < batch_size; ++j) {
+      Entry& entry = entries_[base + j];
+      entry.distance.assign(num_sites_, kUnreachableDistance);
+      entry.overflow.clear();
+    }
+
+    std::vector<uint64_t> visited(num_sites_);
+    std::vector<uint64_t> frontier(num_sites_);
+    std::vector<uint64_t> next(num_sites_);
+    std::vector<int> frontier_list;
+    std::vector<int> next_list;
+    for (size_t j = 0; j < batch_size; ++j) {
+      int mine_site_index = mine_list_[base + j];
+      entries_[base + j].distance[mine_site_index] = 0;
+      if (!visited[mine_site_index])
+        frontier_list.push_back(mine_site_index);
+      visited[mine_site_index] |= uint64_t{1} << j;
+      frontier[mine_site_index] = visited[mine_site_index];
+    }
+
+    for (int dist = 1; !frontier_list.empty(); ++dist) {
+      next_list.clear();
+      for (int site_index : frontier_list) {
+        uint64_t mask = frontier[site_index];
+        frontier[site_index] = 0;
+        for (int i = adjacency_.offsets[site_index];
+             i < adjacency_.offsets[site_index + 1]; ++i) {
+          int next_site_index = adjacency_.neighbors[i];
+          uint64_t reached = mask & ~visited[next_site_index];
+          if (!reached)
+            continue;
+          if (!next[next_site_index])
+            next_list.push_back(next_site_index);
+          next[next_site_index] |= reached;
+        }
+      }
+
+      for (int site_index : next_list) {
+        uint64_t reached = next[site_index];
+        next[site_index] = 0;
+        visited[site_index] |= reached;
+        frontier[site_index] = reached;
+        for (; reached; reached &= reached - 1) {
+          Entry& entry = entries_[base + __builtin_ctzll(reached)];
+          if (dist < kUnreachableDistance) {
+            entry.distance[site_index] = dist;
+          } else {
+            entry.distance[site_index] = kOverflowDistance;
+            entry.overflow.emplace_back(site_index, dist);
+          }
+        }
+      }
+      frontier_list.swap(next_list);
+    }
+
+    for (size_t j = 0; j < batch_size; ++j) {
+      std::vector<std::pair<int, int>>& overflow = entries_[base + j].overflow;
+      std::sort(overflow.begin(), overflow.end());
+    }
+  }
+
+  size_t num_sites_ = 0;
+  std::vector<int> mine_list_;  // mine_index -> site_index.
+  Adjacency adjacency_;
+  // mine_index -> Entry. Mutable for lazy computation in const queries.
+  mutable std::vector<Entry> entries_;
+
   DISALLOW_COPY_AND_ASSIGN(DistanceMap);
 };
 
-class UnionFindSet {
+// Union-find over the sites claimed by a punter. A root owns a contiguous row
+// of per-mine scores once a claim or a future touches it; until then its
+// scores are the squared distances, read from the distance map. Rows of
+// non-root sites are kept only for Rollback(), which also releases the rows
+// that the undone merges allocated.
+// The punter's total score is maintained incrementally on every update.
+// Merges made after Mark() are journaled and can be undone by Rollback();
+// path compression is suspended meanwhile so that each undo is exact.
+class Scorer::UnionFindSet {
  public:
-  UnionFindSet(ScorerUnionFindSetProto* proto,
-               bool dry_run=false)
-      : proto_(proto) {
-    if (dry_run)
-      dry_run_ = std::map<size_t, ScoreCell>();
+  UnionFindSet() = default;
+
+  void Initialize(const DistanceMap* distance_map,
+                  const std::vector<int>& mine_index_list,
+                  size_t num_sites) {
+    distance_map_ = distance_map;
+    num_sites_ = num_sites;
+    num_mines_ = mine_index_list.size();
+    mine_index_list_ = mine_index_list;
+    parent_.resize(num_sites_);
+    for (size_t i = 0; i < num_sites_; ++i)
+      parent_[i] = i;
+    size_.assign(num_sites_, 1);
+    next_.resize(num_sites_);
+    for (size_t i = 0; i < num_sites_; ++i)
+      next_[i] = i;
+    row_index_.assign(num_sites_, -1);
+    mine_masks_.clear();
+    if (num_mines_ <= kMaxMaskedMines) {
+      mine_masks_.resize(num_sites_);
+      for (size_t i = 0; i < num_mines_; ++i)
+        mine_masks_[mine_index_list_[i]] |= uint64_t{1} << i;
+    }
+    scores_.clear();
+    futures_.clear();
+    undo_log_.clear();
+    marks_.clear();
+    // Every mine is a singleton scoring 0.
+    total_score_ = 0;
   }
 
-  void Initialize(size_t num_sites) {
-    proto_->mutable_cells()->Reserve(num_sites);
-    for (size_t i = 0; i < num_sites; ++i)
-      proto_->add_cells();
+  // Scores are not serialized; they are rebuilt from the distance map, the
+  // futures and the component structure.
+  void Load(const ScorerUnionFindSetProto& proto,
+            const DistanceMap* distance_map,
+            const std::vector<int>& mine_index_list,
+            size_t num_sites) {
+    Initialize(distance_map, mine_index_list, num_sites);
+    for (const auto& future : proto.futures())
+      AddFutureInternal(future.mine_index(), future.target_site_index());
+    DCHECK_EQ(proto.linked_site_index_size(), proto.parent_index_size());
+    for (int i = 0; i < proto.linked_site_index_size(); ++i)
+      parent_[proto.linked_site_index(i)] = proto.parent_index(i);
+    size_.assign(num_sites_, 0);
+    for (size_t i = 0; i < num_sites_; ++i)
+      ++size_[FindIndex(i)];
+    for (size_t i = 0; i < num_sites_; ++i) {
+      int root = FindIndex(i);
+      if (root != static_cast<int>(i)) {
+        MaterializeRow(root);
+        AddRowTo(i, root);
+        std::swap(next_[root], next_[i]);
+        if (use_mine_masks())
+          mine_masks_[root] |= mine_masks_[i];
+      }
+    }
+    UpdateTotalScore();
   }
 
-  void SetDistanceMap(const DistanceMap& distance_map) {
-    for (int i = 0; i < proto_->cells_size(); ++i) {
-      for (int j = 0; j < distance_map.mine_size(); ++j) {
-        int dist = distance_map.GetDistance(j, i);
-        mutable_cells(i)->add_scores(dist * dist);
+  void Save(ScorerUnionFindSetProto* proto) const {
+    DCHECK(marks_.empty());
+    proto->Clear();
+    // Only sites linked under another one; the rest are singleton roots.
+    for (size_t i = 0; i < num_sites_; ++i) {
+      if (parent_[i] != static_cast<int>(i)) {
+        proto->add_linked_site_index(i);
+        proto->add_parent_index(parent_[i]);
       }
     }
+    for (const auto& future : futures_) {
+      ScorerFutureProto* future_proto = proto->add_futures();
+      future_proto->set_mine_index(future.first);
+      future_proto->set_target_site_index(future.second);
+    }
   }
 
-  void AddFuture(
-      size_t mine_index, int mine_site_index, int target_site_index,
-      int distance) {
-    int score = distance * distance * distance;
-    DCHECK_EQ(0, cells(mine_site_index).scores(mine_index));
-    mutable_cells(mine_site_index)->set_scores(mine_index, -score);
-    mutable_cells(target_site_index)->set_scores(
-        mine_index, cells(target_site_index).scores(mine_index) + 2 * score);
+  void AddFuture(size_t mine_index, int target_site_index) {
+    DCHECK(marks_.empty()) << "Futures cannot be rolled back";
+    AddFutureInternal(mine_index, target_site_index);
+    UpdateTotalScore();
   }
 
+  int total_score() const { return total_score_; }
+
   int GetScore(int site_index, int mine_index) const {
-    int index = FindIndex(site_index);
-    return cells(index).scores(mine_index);
+    return GetRootScore(FindIndex(site_index), mine_index);
   }
 
   bool IsConnected(int site_index1, int site_index2) const {
@@ -163,107 +420,361 @@ class UnionFindSet {
     if (site_index1 == site_index2)
       return;
 
-    // TODO use rank?
-    auto* cell1 = mutable_cells(site_index1);
-    auto* cell2 = mutable_cells(site_index2);
-    for (int i = 0; i < cell1->scores_size(); ++i) {
-      cell1->set_scores(i, cell1->scores(i) + cell2->scores(i));
+    int old_total_score = total_score_;
+    total_score_ += GetRootMergeGain(site_index1, site_index2);
+
+    // Attach the smaller tree under the larger one.
+    if (size_[site_index1] < size_[site_index2])
+      std::swap(site_index1, site_index2);
+
+    bool materialized = num_mines_ > 0 && row_index_[site_index1] < 0;
+    MaterializeRow(site_index1);
+    AddRowTo(site_index2, site_index1);
+    parent_[site_index2] = site_index1;
+    size_[site_index1] += size_[site_index2];
+    // Splices the two circular member lists into one.
+    std::swap(next_[site_index1], next_[site_index2]);
+    if (use_mine_masks())
+      mine_masks_[site_index1] |= mine_masks_[site_index2];
+    if (!marks_.empty()) {
+      undo_log_.push_back(
+          {site_index1, site_index2, old_total_score, materialized});
+    }
+  }
+
+  // Returns the score gain of merging the components of the two sites.
+  int GetMergeGain(int site_index1, int site_index2) const {
+    return GetRootMergeGain(FindIndex(site_index1), FindIndex(site_index2));
+  }
+
+  // Returns the score gain of merging each of |site_index_pairs|, each
+  // evaluated independently against the current state.
+  std::vector<int> GetMergeGains(
+      const std::vector<std::pair<int, int>>& site_index_pairs) const {
+    std::vector<int> result;
+    result.reserve(site_index_pairs.size());
+    if (use_mine_masks()) {
+      for (const auto& site_index_pair : site_index_pairs) {
+        result.push_back(
+            GetMergeGain(site_index_pair.first, site_index_pair.second));
+      }
+      return result;
+    }
+
+    // Roots are resolved lazily, at most once per site.
+    std::vector<int> roots(num_sites_, -1);
+    auto find_root = [this, &roots](int site_index) {
+      if (roots[site_index] < 0)
+        roots[site_index] = FindIndex(site_index);
+      return roots[site_index];
+    };
+
+    // Mines grouped by the root of their component, as singly linked lists.
+    std::vector<int> first_mine(num_sites_, -1);
+    std::vector<int> next_mine(num_mines_, -1);
+    for (size_t i = 0; i < num_mines_; ++i) {
+      int root = find_root(mine_index_list_[i]);
+      next_mine[i] = first_mine[root];
+      first_mine[root] = i;
+    }
+
+    for (const auto& site_index_pair : site_index_pairs) {
+      int root1 = find_root(site_index_pair.first);
+      int root2 = find_root(site_index_pair.second);
+      int gain = 0;
+      if (root1 != root2) {
+        for (int i = first_mine[root1]; i >= 0; i = next_mine[i])
+          gain += GetRootScore(root2, i);
+        for (int i = first_mine[root2]; i >= 0; i = next_mine[i])
+          gain += GetRootScore(root1, i);
+      }
+      result.push_back(gain);
+    }
+    return result;
+  }
+
+  // Returns the sites connected to |site_index|, including itself, in no
+  // particular order.
+  std::vector<int> GetConnectedSites(int site_index) const {
+    std::vector<int> result;
+    int site = site_index;
+    do {
+      result.push_back(site);
+      site = next_[site];
+    } while (site != site_index);
+    return result;
+  }
+
+  // Returns the mine indexes connected to |site_index|, sorted.
+  std::vector<int> GetConnectedMines(int site_index) const {
+    std::vector<int> result;
+    int root = FindIndex(site_index);
+    if (use_mine_masks()) {
+      for (uint64_t mask = mine_masks_[root]; mask; mask &= mask - 1)
+        result.push_back(__builtin_ctzll(mask));
+      return result;
+    }
+    for (size_t i = 0; i < num_mines_; ++i) {
+      if (FindIndex(mine_index_list_[i]) == root)
+        result.push_back(i);
+    }
+    return result;
+  }
+
+  void Mark() { marks_.push_back(undo_log_.size()); }
+
+  // Undoes all the merges since the last Mark(), in reverse order.
+  void Rollback() {
+    DCHECK(!marks_.empty());
+    size_t mark = marks_.back();
+    marks_.pop_back();
+    while (undo_log_.size() > mark) {
+      const UndoEntry& entry = undo_log_.back();
+      if (entry.materialized) {
+        // Rows are allocated in stack order, so this is the last one.
+        DCHECK_EQ(scores_.size() / num_mines_ - 1,
+                  static_cast<size_t>(row_index_[entry.root]));
+        scores_.resize(scores_.size() - num_mines_);
+        row_index_[entry.root] = -1;
+      } else {
+        SubtractRowFrom(entry.child, entry.root);
+      }
+      parent_[entry.child] = entry.child;
+      size_[entry.root] -= size_[entry.child];
+      // Splicing is its own inverse.
+      std::swap(next_[entry.root], next_[entry.child]);
+      if (use_mine_masks())
+        mine_masks_[entry.root] &= ~mine_masks_[entry.child];
+      total_score_ = entry.total_score;
+      undo_log_.pop_back();
     }
-    cell2->set_parent_index(site_index1);
   }
+
  private:
-  int FindIndex(int site_index) const {
-    if (!cells(site_index).has_parent_index())
-      return site_index;
+  void AddFutureInternal(size_t mine_index, int target_site_index) {
+    int mine_site_index = mine_index_list_[mine_index];
+    int distance = distance_map_->GetDistance(mine_index, target_site_index);
+    int score = distance * distance * distance;
+    int* mine_row = MaterializeRow(mine_site_index);
+    DCHECK_EQ(0, mine_row[mine_index]);
+    mine_row[mine_index] = -score;
+    MaterializeRow(target_site_index)[mine_index] += 2 * score;
+    futures_.emplace_back(mine_index, target_site_index);
+  }
+
+  // Recomputes total_score_ from scratch. A mine without a row is still a
+  // singleton with no future, so it scores 0.
+  void UpdateTotalScore() {
+    total_score_ = 0;
+    for (size_t i = 0; i < num_mines_; ++i) {
+      int root = FindIndex(mine_index_list_[i]);
+      if (row_index_[root] >= 0)
+        total_score_ += row(root)[i];
+    }
+  }
+
+  // Maps with few mines keep the set of connected mines of each component as
+  // a bit mask, so that mine queries are bit scans instead of finds.
+  static const size_t kMaxMaskedMines = 64;
+  bool use_mine_masks() const { return !mine_masks_.empty(); }
+
+  // Each mine in one component now also scores the other component.
+  int GetRootMergeGain(int root1, int root2) const {
+    if (root1 == root2)
+      return 0;
+    int gain = 0;
+    if (use_mine_masks()) {
+      for (uint64_t mask = mine_masks_[root1]; mask; mask &= mask - 1)
+        gain += GetRootScore(root2, __builtin_ctzll(mask));
+      for (uint64_t mask = mine_masks_[root2]; mask; mask &= mask - 1)
+        gain += GetRootScore(root1, __builtin_ctzll(mask));
+      return gain;
+    }
+    for (size_t i = 0; i < num_mines_; ++i) {
+      int mine_root = FindIndex(mine_index_list_[i]);
+      if (mine_root == root1)
+        gain += GetRootScore(root2, i);
+      else if (mine_root == root2)
+        gain += GetRootScore(root1, i);
+    }
+    return gain;
+  }
 
-    // Short circuit.
-    int root_index = FindIndex(cells(site_index).parent_index());
+  int GetBaseScore(int site_index, size_t mine_index) const {
+    int distance = distance_map_->GetDistance(mine_index, site_index);
+    return distance * distance;
+  }
 
-    // Use mutable value.
-    mutable_cells(site_index)->set_parent_index(root_index);
-    return root_index;
+  int GetRootScore(int root, size_t mine_index) const {
+    return row_index_[root] >= 0 ? row(root)[mine_index]
+                                 : GetBaseScore(root, mine_index);
   }
 
-  const ScoreCell& cells(size_t index) const {
-    if (dry_run_) {
-      auto it = dry_run_.value().find(index);
-      if (it != dry_run_.value().end())
-        return it->second;
+  // Gives |site_index| its own row, filled with the base scores, if it does
+  // not have one yet. Without mines rows would be empty, so none is made.
+  int* MaterializeRow(int site_index) {
+    if (num_mines_ > 0 && row_index_[site_index] < 0) {
+      row_index_[site_index] = scores_.size() / num_mines_;
+      scores_.resize(scores_.size() + num_mines_);
+      int* scores = row(site_index);
+      for (size_t i = 0; i < num_mines_; ++i)
+        scores[i] = GetBaseScore(site_index, i);
     }
-    return proto_->cells(index);
+    return row(site_index);
   }
 
-  ScoreCell* mutable_cells(size_t index) const {
-    if (dry_run_) {
-      auto it = dry_run_.value().find(index);
-      if (it != dry_run_.value().end())
-        return &it->second;
-      ScoreCell* result = &dry_run_.value()[index];
-      result->CopyFrom(proto_->cells(index));
-      return result;
+  // Adds (or subtracts) the scores of |site_index| to the row of |root|,
+  // which must be materialized.
+  void AddRowTo(int site_index, int root) {
+    if (row_index_[site_index] >= 0) {
+      AddScores(row(site_index), num_mines_, row(root));
+      return;
     }
-    return proto_->mutable_cells(index);
+    int* scores = row(root);
+    for (size_t i = 0; i < num_mines_; ++i)
+      scores[i] += GetBaseScore(site_index, i);
+  }
+  void SubtractRowFrom(int site_index, int root) {
+    if (row_index_[site_index] >= 0) {
+      SubtractScores(row(site_index), num_mines_, row(root));
+      return;
+    }
+    int* scores = row(root);
+    for (size_t i = 0; i < num_mines_; ++i)
+      scores[i] -= GetBaseScore(site_index, i);
   }
 
-  mutable ScorerUnionFindSetProto* proto_;
-  mutable base::Optional<std::map<size_t, ScoreCell>> dry_run_;
+  // A merge recorded after Mark(): |child| was linked under |root|.
+  struct UndoEntry {
+    int root;
+    int child;
+    int total_score;  // Before the merge.
+    bool materialized;  // Whether the merge gave |root| its row.
+  };
 
-  DISALLOW_COPY_AND_ASSIGN(UnionFindSet);
+  // Path halving: every other node on the path is linked to its grandparent.
+  // Union by size alone keeps the trees shallow while marked.
+  int FindIndex(int site_index) const {
+    if (!marks_.empty()) {
+      while (parent_[site_index] != site_index)
+        site_index = parent_[site_index];
+      return site_index;
+    }
+    while (parent_[site_index] != site_index) {
+      parent_[site_index] = parent_[parent_[site_index]];
+      site_index = parent_[site_index];
+    }
+    return site_index;
+  }
+
+  int* row(size_t site_index) {
+    return scores_.data() + row_index_[site_index] * num_mines_;
+  }
+  const int* row(size_t site_index) const {
+    return scores_.data() + row_index_[site_index] * num_mines_;
+  }
+
+  const DistanceMap* distance_map_ = nullptr;
+  size_t num_sites_ = 0;
+  size_t num_mines_ = 0;
+  std::vector<int> mine_index_list_;  // mine_index -> site_index.
+  int total_score_ = 0;
+  // Mutable for path compression in const queries.
+  mutable std::vector<int> parent_;  // site_index -> parent site_index.
+  std::vector<int> size_;  // site_index -> tree size, valid only for roots.
+  // site_index -> next site in the circular list of its component's members.
+  std::vector<int> next_;
+  std::vector<int> row_index_;  // site_index -> row in scores_, or -1.
+  // site_index -> bit mask of connected mine indexes, valid only for roots.
+  // Empty if there are more than kMaxMaskedMines mines.
+  std::vector<uint64_t> mine_masks_;
+  std::vector<int> scores_;  // row * num_mines + mine_index.
+  // (mine_index, target_site_index) of each future, to be serialized.
+  std::vector<std::pair<int, int>> futures_;
+  std::vector<UndoEntry> undo_log_;
+  std::vector<size_t> marks_;  // Sizes of undo_log_ at each Mark().
 };
 
-}  // namespace
+Scorer::Scorer() = default;
 
-Scorer::Scorer(ScorerProto* data) : data_(data) {}
 Scorer::~Scorer() = default;
 
+void Scorer::Load(const ScorerProto& data) {
+  site_ids_.assign(data.site_ids().begin(), data.site_ids().end());
+  site_index_map_.Build(site_ids_);
+  mine_index_list_.assign(
+      data.mine_index_list().begin(), data.mine_index_list().end());
+
+  distance_map_ = base::MakeUnique<DistanceMap>();
+  distance_map_->Load(
+      data.distance_map(), mine_index_list_, site_ids_.size());
+
+  union_find_sets_.clear();
+  for (const auto& scores : data.scores()) {
+    union_find_sets_.push_back(base::MakeUnique<UnionFindSet>());
+    union_find_sets_.back()->Load(
+        scores, distance_map_.get(), mine_index_list_, site_ids_.size());
+  }
+}
+
+void Scorer::Save(ScorerProto* data) const {
+  data->Clear();
+  AppendToRepeatedField(site_ids_.data(), site_ids_.data() + site_ids_.size(),
+                        data->mutable_site_ids());
+  AppendToRepeatedField(
+      mine_index_list_.data(),
+      mine_index_list_.data() + mine_index_list_.size(),
+      data->mutable_mine_index_list());
+  if (distance_map_)
+    distance_map_->Save(data->mutable_distance_map());
+  for (const auto& union_find_set : union_find_sets_)
+    union_find_set->Save(data->add_scores());
+}
+
 void Scorer::Initialize(size_t num_punters, const GameMap& game_map) {
-  CreateSiteIdList(game_map.sites, data_->mutable_site_ids());
-  CreateMineIndexList(
-      game_map.mines, data_->site_ids(), data_->mutable_mine_index_list());
+  DCHECK_EQ(game_map.sites.size(), game_map.site_index_map.size())
+      << "GameMap::BuildSiteIndex() is not called";
+  site_ids_ = CreateSiteIdList(game_map.sites);
+  site_index_map_ = game_map.site_index_map;
+  mine_index_list_ = CreateMineIndexList(game_map.mines, site_index_map_);
 
-  DistanceMap distance_map(data_->mutable_distance_map());
-  distance_map.Initialize(
-      game_map, data_->site_ids(), data_->mine_index_list());
+  distance_map_ = base::MakeUnique<DistanceMap>();
+  distance_map_->Initialize(game_map, mine_index_list_);
 
+  union_find_sets_.clear();
   for (size_t i = 0; i < num_punters; ++i) {
-    UnionFindSet union_find_set(data_->add_scores());
-    union_find_set.Initialize(data_->site_ids_size());
-    union_find_set.SetDistanceMap(distance_map);
+    union_find_sets_.push_back(base::MakeUnique<UnionFindSet>());
+    union_find_sets_.back()->Initialize(
+        distance_map_.get(), mine_index_list_, site_ids_.size());
   }
 }
 
+int Scorer::GetSiteIndex(int site_id) const {
+  return site_index_map_.Get(site_id);
+}
+
+int Scorer::GetMineIndex(int site_index) const {
+  return GetIndex(mine_index_list_, site_index);
+}
+
 void Scorer::AddFuture(
     size_t punter_id, const std::vector<Future>& futures) {
-  UnionFindSet union_find_set(data_->mutable_scores(punter_id));
-  DistanceMap distance_map(data_->mutable_distance_map());
+  UnionFindSet& union_find_set = *union_find_sets_[punter_id];
 
   // Assume futures is valid.
   for (const auto& future : futures) {
-    int source_index = GetIndex(data_->site_ids(), future.source);
-    int mine_index = GetIndex(data_->mine_index_list(), source_index);
-    int target_index = GetIndex(data_->site_ids(), future.target);
-
-    union_find_set.AddFuture(
-        mine_index, source_index, target_index,
-        distance_map.GetDistance(mine_index, target_index));
+    int mine_index = GetMineIndex(GetSiteIndex(future.source));
+    union_find_set.AddFuture(mine_index, GetSiteIndex(future.target));
   }
 }
 
 int Scorer::GetScore(size_t punter_id) const {
-  UnionFindSet ufset(data_->mutable_scores(punter_id));
-
-  int score = 0;
-  for (int i = 0; i < data_->mine_index_list_size(); ++i)
-    score += ufset.GetScore(data_->mine_index_list(i), i);
-
-  return score;
+  return union_find_sets_[punter_id]->total_score();
 }
 
 void Scorer::Claim(size_t punter_id, int site_id1, int site_id2) {
-  UnionFindSet ufset(data_->mutable_scores(punter_id));
-  int site_index1 = GetIndex(data_->site_ids(), site_id1);
-  int site_index2 = GetIndex(data_->site_ids(), site_id2);
-  ufset.Merge(site_index1, site_index2);
+  union_find_sets_[punter_id]->Merge(
+      GetSiteIndex(site_id1), GetSiteIndex(site_id2));
 }
 
 void Scorer::Splurge(size_t punter_id, const std::vector<int>& route) {
@@ -276,91 +787,81 @@ void Scorer::Option(size_t punter_id, int site_id1, int site_id2) {
 }
 
 int Scorer::TryClaim(size_t punter_id, int site_id1, int site_id2) const {
-  int score = GetScore(punter_id);
-  UnionFindSet ufset(data_->mutable_scores(punter_id));
-
-  int site_index1 = GetIndex(data_->site_ids(), site_id1);
-  int site_index2 = GetIndex(data_->site_ids(), site_id2);
-
-  if (ufset.IsConnected(site_index1, site_index2))
-    return score;
+  const UnionFindSet& ufset = *union_find_sets_[punter_id];
+  return ufset.total_score() +
+      ufset.GetMergeGain(GetSiteIndex(site_id1), GetSiteIndex(site_id2));
+}
 
-  for (int i = 0; i < data_->mine_index_list_size(); ++i) {
-    int mine_index = data_->mine_index_list(i);
-    if (ufset.IsConnected(mine_index, site_index1)) {
-      score += ufset.GetScore(site_index2, i);
-      continue;
-    }
-    if (ufset.IsConnected(mine_index, site_index2)) {
-      score += ufset.GetScore(site_index1, i);
-      continue;
-    }
+std::vector<int> Scorer::TryClaimAll(
+    size_t punter_id, const std::vector<River>& rivers) const {
+  std::vector<std::pair<int, int>> site_index_pairs;
+  site_index_pairs.reserve(rivers.size());
+  for (const auto& river : rivers) {
+    site_index_pairs.emplace_back(
+        GetSiteIndex(river.source), GetSiteIndex(river.target));
   }
-
-  return score;
+  return union_find_sets_[punter_id]->GetMergeGains(site_index_pairs);
 }
 
 bool Scorer::IsConnected(size_t punter_id, int site_id1, int site_id2) const {
-  return UnionFindSet(data_->mutable_scores(punter_id)).IsConnected(
-      GetIndex(data_->site_ids(), site_id1),
-      GetIndex(data_->site_ids(), site_id2));
+  return union_find_sets_[punter_id]->IsConnected(
+      GetSiteIndex(site_id1), GetSiteIndex(site_id2));
 }
 
 std::vector<int> Scorer::GetConnectedMineList(size_t punter_id, int site_id)
     const {
   std::vector<int> result;
-  int site_index = GetIndex(data_->site_ids(), site_id);
-  UnionFindSet ufset(data_->mutable_scores(punter_id));
-  for (int i = 0; i < data_->mine_index_list_size(); ++i) {
-    int mine_index = data_->mine_index_list(i);
-    if (ufset.IsConnected(mine_index, site_index)) {
-      result.push_back(data_->site_ids(mine_index));
-    }
+  for (int mine_index : union_find_sets_[punter_id]->GetConnectedMines(
+           GetSiteIndex(site_id))) {
+    result.push_back(site_ids_[mine_index_list_[mine_index]]);
   }
   return result;
 }
 
-
 std::vector<int> Scorer::GetConnectedSiteList(size_t punter_id, int site_id)
     const {
-  std::vector<int> result;
-  int site_index = GetIndex(data_->site_ids(), site_id);
-  UnionFindSet ufset(data_->mutable_scores(punter_id));
-  for (int i = 0; i < data_->site_ids_size(); ++i) {
-    if (ufset.IsConnected(i, site_index)) {
-      result.push_back(data_->site_ids(i));
-    }
-  }
+  std::vector<int> result = union_find_sets_[punter_id]->GetConnectedSites(
+      GetSiteIndex(site_id));
+  // Site ids are sorted like site indexes.
+  std::sort(result.begin(), result.end());
+  for (int& site : result)
+    site = site_ids_[site];
   return result;
 }
 
+void Scorer::Mark() {
+  for (const auto& union_find_set : union_find_sets_)
+    union_find_set->Mark();
+}
+
+void Scorer::Rollback() {
+  for (const auto& union_find_set : union_find_sets_)
+    union_find_set->Rollback();
+}
+
 std::vector<int> Scorer::Simulate(const std::vector<GameMove>& moves) const {
-  std::vector<std::unique_ptr<UnionFindSet>> ufsets;
-  for (int i = 0; i < data_->scores_size(); ++i) {
-    ufsets.push_back(base::MakeUnique<UnionFindSet>(
-        data_->mutable_scores(i), true));
-  }
+  // Dry-run in place; everything is rolled back before returning, so this is
+  // logically const.
+  for (const auto& union_find_set : union_find_sets_)
+    union_find_set->Mark();
 
   for (const auto& m : moves) {
-    UnionFindSet& ufset = *ufsets[m.punter_id];
+    UnionFindSet& ufset = *union_find_sets_[m.punter_id];
     switch (m.type) {
       case GameMove::Type::CLAIM: {
-        int site_index1 = GetIndex(data_->site_ids(), m.source);
-        int site_index2 = GetIndex(data_->site_ids(), m.target);
-        ufset.Merge(site_index1, site_index2);
+        ufset.Merge(GetSiteIndex(m.source), GetSiteIndex(m.target));
+        break;
       }
       case GameMove::Type::SPLURGE: {
         for (size_t i = 1; i < m.route.size(); ++i) {
-          int site_index1 = GetIndex(data_->site_ids(), m.route[i - 1]);
-          int site_index2 = GetIndex(data_->site_ids(), m.route[i]);
-          ufset.Merge(site_index1, site_index2);
+          ufset.Merge(GetSiteIndex(m.route[i - 1]),
+                      GetSiteIndex(m.route[i]));
         }
         break;
       }
       case GameMove::Type::OPTION: {
-        int site_index1 = GetIndex(data_->site_ids(), m.source);
-        int site_index2 = GetIndex(data_->site_ids(), m.target);
-        ufset.Merge(site_index1, site_index2);
+        ufset.Merge(GetSiteIndex(m.source), GetSiteIndex(m.target));
+        break;
       }
       case GameMove::Type::PASS: {
         // Do nothing.
@@ -370,24 +871,16 @@ std::vector<int> Scorer::Simulate(const std::vector<GameMove>& moves) const {
   }
 
   std::vector<int> result;
-  for (int punter_id = 0; punter_id < data_->scores_size(); ++punter_id) {
-    UnionFindSet& ufset = *ufsets[punter_id];
-    int score = 0;
-    for (int i = 0; i < data_->mine_index_list_size(); ++i) {
-      score += ufset.GetScore(data_->mine_index_list(i), i);
-    }
-    result.push_back(score);
+  for (const auto& union_find_set : union_find_sets_) {
+    result.push_back(union_find_set->total_score());
+    union_find_set->Rollback();
   }
   return result;
 }
 
 int Scorer::GetDistanceToMine(int mine_site_id, int target_site_id) const {
-  int mine_site_index = GetIndex(data_->site_ids(), mine_site_id);
-  int mine_index = GetIndex(data_->mine_index_list(), mine_site_index);
-  int target_site_index = GetIndex(data_->site_ids(), target_site_id);
-
-  DistanceMap distance_map(data_->mutable_distance_map());
-  return distance_map.GetDistance(mine_index, target_site_index);
+  int mine_index = GetMineIndex(GetSiteIndex(mine_site_id));
+  return distance_map_->GetDistance(mine_index, GetSiteIndex(target_site_id));
 }
 
-}  // namespace stadium
+}  // namespace common
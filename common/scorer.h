@@ -1,6 +1,7 @@
 #ifndef COMMON_SCORER_H_
 #define COMMON_SCORER_H_
 
+#include <memory>
 #include <vector>
 
 #include "common/game_data.h"
@@ -8,11 +9,16 @@
 
 namespace common {
 
+// Keeps track of the score of each punter. The state lives in flat native
+// arrays; ScorerProto is only touched by Load() and Save().
 class Scorer {
  public:
-  explicit Scorer(ScorerProto* data);
+  Scorer();
   ~Scorer();
 
+  void Load(const ScorerProto& data);
+  void Save(ScorerProto* data) const;
+
   void Initialize(size_t num_punters, const GameMap& game_map);
   void AddFuture(size_t punter_id, const std::vector<Future>& futures);
 
@@ -23,6 +29,10 @@ class Scorer {
   void Option(size_t punter_id, int site_id1, int site_id2);
 
   int TryClaim(size_t punter_id, int site_id1, int site_id2) const;
+  // Returns the score gain of claiming each of |rivers| on its own, in one
+  // pass. Cheaper than calling TryClaim() for every river.
+  std::vector<int> TryClaimAll(
+      size_t punter_id, const std::vector<River>& rivers) const;
   bool IsConnected(size_t punter_id, int site_id1, int site_id2) const;
 
   int GetDistanceToMine(int mine_site_id, int target_site_id) const;
@@ -30,10 +40,27 @@ class Scorer {
   std::vector<int> GetConnectedMineList(size_t punter_id, int site_id) const;
   std::vector<int> GetConnectedSiteList(size_t punter_id, int site_id) const;
 
+  // Checkpoints the claim state. Claims made after Mark() are undone by the
+  // matching Rollback(). Marks nest. Futures cannot be added while marked.
+  void Mark();
+  void Rollback();
+
+  // Returns the scores after |moves|, leaving the state unchanged.
   std::vector<int> Simulate(const std::vector<GameMove>& moves) const;
 
  private:
-  mutable ScorerProto* data_;
+  class DistanceMap;
+  class UnionFindSet;
+
+  int GetSiteIndex(int site_id) const;
+  int GetMineIndex(int site_index) const;
+
+  std::vector<int> site_ids_;  // site_index -> site_id, sorted.
+  SiteIndexMap site_index_map_;  // site_id -> site_index.
+  std::vector<int> mine_index_list_;  // mine_index -> site_index, sorted.
+  std::unique_ptr<DistanceMap> distance_map_;
+  // punter_id -> UFSet.
+  std::vector<std::unique_ptr<UnionFindSet>> union_find_sets_;
 
   DISALLOW_COPY_AND_ASSIGN(Scorer);
 };
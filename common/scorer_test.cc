@@ -0,0 +1,413 @@
+#include "common/scorer.h"
+
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <random>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "common/game_data.h"
+#include "gtest/gtest.h"
+
+namespace common {
+namespace {
+
+// A path 0 - 1 - 2 - ... - (num_sites - 1).
+GameMap MakePathMap(int num_sites, const std::vector<int>& mines) {
+  GameMap game_map;
+  for (int i = 0; i < num_sites; ++i)
+    game_map.sites.push_back(Site{i});
+  for (int i = 0; i + 1 < num_sites; ++i)
+    game_map.rivers.push_back(River{i, i + 1});
+  game_map.mines = mines;
+  game_map.BuildSiteIndex();
+  return game_map;
+}
+
+// A connected map: a path over the sites in random order, plus
+// |num_extra_rivers| random rivers. Site ids are sparse and unsorted.
+GameMap MakeRandomMap(int num_sites, int num_extra_rivers, int num_mines,
+                      std::mt19937* rng) {
+  std::vector<int> ids;
+  for (int i = 0; i < num_sites; ++i)
+    ids.push_back(3 * i + 7);
+  std::shuffle(ids.begin(), ids.end(), *rng);
+
+  GameMap game_map;
+  std::set<std::pair<int, int>> rivers;
+  auto add_river = [&game_map, &rivers](int source, int target) {
+    if (source == target ||
+        !rivers.emplace(std::min(source, target),
+                        std::max(source, target)).second) {
+      return;
+    }
+    game_map.rivers.push_back(River{source, target});
+  };
+  for (int i = 0; i < num_sites; ++i) {
+    game_map.sites.push_back(Site{ids[i]});
+    if (i > 0)
+      add_river(ids[i - 1], ids[i]);
+  }
+  std::uniform_int_distribution<int> site(0, num_sites - 1);
+  for (int i = 0; i < num_extra_rivers; ++i)
+    add_river(ids[site(*rng)], ids[site(*rng)]);
+  std::shuffle(game_map.rivers.begin(), game_map.rivers.end(), *rng);
+
+  game_map.mines.assign(ids.begin(), ids.begin() + num_mines);
+  game_map.BuildSiteIndex();
+  return game_map;
+}
+
+using Adjacency = std::map<int, std::vector<int>>;
+
+Adjacency MakeAdjacency(const std::vector<River>& rivers) {
+  Adjacency adjacency;
+  for (const River& river : rivers) {
+    adjacency[river.source].push_back(river.target);
+    adjacency[river.target].push_back(river.source);
+  }
+  return adjacency;
+}
+
+// Site id -> distance from |start|, for the sites reachable over |adjacency|.
+std::map<int, int> Distances(const Adjacency& adjacency, int start) {
+  std::map<int, int> distances = {{start, 0}};
+  std::queue<int> queue;
+  queue.push(start);
+  while (!queue.empty()) {
+    int site = queue.front();
+    queue.pop();
+    auto iter = adjacency.find(site);
+    if (iter == adjacency.end())
+      continue;
+    for (int next : iter->second) {
+      if (distances.emplace(next, distances[site] + 1).second)
+        queue.push(next);
+    }
+  }
+  return distances;
+}
+
+// Scores |claims| from scratch: for each mine, the squared map distance of
+// each site reachable from it over |claims|.
+int ReferenceScore(const GameMap& game_map, const std::vector<River>& claims) {
+  const Adjacency map_adjacency = MakeAdjacency(game_map.rivers);
+  const Adjacency claim_adjacency = MakeAdjacency(claims);
+  int score = 0;
+  for (int mine : game_map.mines) {
+    std::map<int, int> map_distances = Distances(map_adjacency, mine);
+    for (const auto& entry : Distances(claim_adjacency, mine)) {
+      int distance = map_distances[entry.first];
+      score += distance * distance;
+    }
+  }
+  return score;
+}
+
+TEST(ScorerTest, MatchesReference) {
+  std::mt19937 rng(1);
+  for (int num_mines : {1, 3, 8}) {
+    SCOPED_TRACE(num_mines);
+    const int kNumPunters = 3;
+    GameMap game_map = MakeRandomMap(40, 60, num_mines, &rng);
+    Scorer scorer;
+    scorer.Initialize(kNumPunters, game_map);
+
+    std::vector<std::vector<River>> claims(kNumPunters);
+    for (size_t i = 0; i < game_map.rivers.size(); ++i) {
+      const River& river = game_map.rivers[i];
+      const int punter_id = i % kNumPunters;
+      scorer.Claim(punter_id, river.source, river.target);
+      claims[punter_id].push_back(river);
+      EXPECT_EQ(ReferenceScore(game_map, claims[punter_id]),
+                scorer.GetScore(punter_id));
+      EXPECT_TRUE(scorer.IsConnected(punter_id, river.source, river.target));
+    }
+  }
+}
+
+// Scores and connectivity of every punter, to compare two states.
+std::vector<int> Snapshot(const Scorer& scorer, const GameMap& game_map,
+                          int num_punters) {
+  std::vector<int> result;
+  for (int punter_id = 0; punter_id < num_punters; ++punter_id) {
+    result.push_back(scorer.GetScore(punter_id));
+    for (const River& river : game_map.rivers) {
+      result.push_back(
+          scorer.IsConnected(punter_id, river.source, river.target));
+    }
+  }
+  return result;
+}
+
+TEST(ScorerTest, MarkAndRollback) {
+  std::mt19937 rng(2);
+  const int kNumPunters = 2;
+  GameMap game_map = MakeRandomMap(40, 60, 4, &rng);
+  Scorer scorer;
+  scorer.Initialize(kNumPunters, game_map);
+
+  const size_t num_rivers = game_map.rivers.size();
+  std::vector<std::vector<River>> claims(kNumPunters);
+  size_t next = 0;
+  auto claim = [&](size_t count) {
+    for (size_t end = next + count; next < end; ++next) {
+      const River& river = game_map.rivers[next];
+      scorer.Claim(next % kNumPunters, river.source, river.target);
+      claims[next % kNumPunters].push_back(river);
+    }
+  };
+
+  claim(num_rivers / 4);
+  const std::vector<int> before = Snapshot(scorer, game_map, kNumPunters);
+  const std::vector<std::vector<River>> claims_before = claims;
+
+  scorer.Mark();
+  claim(num_rivers / 4);
+  const std::vector<int> middle = Snapshot(scorer, game_map, kNumPunters);
+
+  scorer.Mark();
+  claim(num_rivers - next);
+  for (int punter_id = 0; punter_id < kNumPunters; ++punter_id) {
+    EXPECT_EQ(ReferenceScore(game_map, claims[punter_id]),
+              scorer.GetScore(punter_id));
+  }
+  scorer.Rollback();
+  EXPECT_EQ(middle, Snapshot(scorer, game_map, kNumPunters));
+
+  scorer.Rollback();
+  EXPECT_EQ(before, Snapshot(scorer, game_map, kNumPunters));
+
+  // Claims after a rollback build on the state before the mark.
+  claims = claims_before;
+  next = claims[0].size() + claims[1].size();
+  claim(num_rivers / 4);
+  EXPECT_EQ(middle, Snapshot(scorer, game_map, kNumPunters));
+}
+
+TEST(ScorerTest, Simulate) {
+  std::mt19937 rng(3);
+  const int kNumPunters = 2;
+  GameMap game_map = MakeRandomMap(30, 40, 3, &rng);
+  Scorer scorer;
+  scorer.Initialize(kNumPunters, game_map);
+
+  std::vector<std::vector<River>> claims(kNumPunters);
+  std::vector<GameMove> moves;
+  for (size_t i = 0; i < game_map.rivers.size(); ++i) {
+    const River& river = game_map.rivers[i];
+    const int punter_id = i % kNumPunters;
+    if (i < game_map.rivers.size() / 2) {
+      scorer.Claim(punter_id, river.source, river.target);
+    } else {
+      moves.push_back(GameMove::Claim(punter_id, river.source, river.target));
+    }
+    claims[punter_id].push_back(river);
+  }
+  moves.push_back(GameMove::Pass(0));
+
+  const std::vector<int> before = Snapshot(scorer, game_map, kNumPunters);
+  std::vector<int> scores = scorer.Simulate(moves);
+  ASSERT_EQ(static_cast<size_t>(kNumPunters), scores.size());
+  for (int punter_id = 0; punter_id < kNumPunters; ++punter_id)
+    EXPECT_EQ(ReferenceScore(game_map, claims[punter_id]), scores[punter_id]);
+  EXPECT_EQ(before, Snapshot(scorer, game_map, kNumPunters));
+}
+
+TEST(ScorerTest, TryClaimAll) {
+  std::mt19937 rng(4);
+  const int kNumPunters = 2;
+  GameMap game_map = MakeRandomMap(40, 60, 5, &rng);
+  Scorer scorer;
+  scorer.Initialize(kNumPunters, game_map);
+
+  std::vector<std::vector<River>> claims(kNumPunters);
+  const size_t num_claimed = game_map.rivers.size() / 3;
+  for (size_t i = 0; i < num_claimed; ++i) {
+    const River& river = game_map.rivers[i];
+    scorer.Claim(i % kNumPunters, river.source, river.target);
+    claims[i % kNumPunters].push_back(river);
+  }
+  // Includes rivers already claimed, which may gain nothing.
+  const std::vector<River> rivers(game_map.rivers.begin() + num_claimed / 2,
+                                  game_map.rivers.end());
+
+  for (int punter_id = 0; punter_id < kNumPunters; ++punter_id) {
+    std::vector<int> gains = scorer.TryClaimAll(punter_id, rivers);
+    ASSERT_EQ(rivers.size(), gains.size());
+    const int score = scorer.GetScore(punter_id);
+    for (size_t i = 0; i < rivers.size(); ++i) {
+      const River& river = rivers[i];
+      EXPECT_EQ(scorer.TryClaim(punter_id, river.source, river.target),
+                score + gains[i]);
+      std::vector<River> with_river = claims[punter_id];
+      with_river.push_back(river);
+      EXPECT_EQ(ReferenceScore(game_map, with_river), score + gains[i]);
+    }
+  }
+}
+
+// Up to 64 mines are tracked as a bit mask, and more as lists.
+TEST(ScorerTest, MineMaskBoundary) {
+  std::mt19937 rng(5);
+  for (int num_mines : {63, 64, 65}) {
+    SCOPED_TRACE(num_mines);
+    const int kNumPunters = 2;
+    GameMap game_map = MakeRandomMap(100, 60, num_mines, &rng);
+    Scorer scorer;
+    scorer.Initialize(kNumPunters, game_map);
+
+    std::vector<std::vector<River>> claims(kNumPunters);
+    for (size_t i = 0; i < game_map.rivers.size(); ++i) {
+      const River& river = game_map.rivers[i];
+      const int punter_id = i % kNumPunters;
+      scorer.Claim(punter_id, river.source, river.target);
+      claims[punter_id].push_back(river);
+      if (i % 10 != 0)
+        continue;
+      EXPECT_EQ(ReferenceScore(game_map, claims[punter_id]),
+                scorer.GetScore(punter_id));
+
+      std::map<int, int> reachable =
+          Distances(MakeAdjacency(claims[punter_id]), river.source);
+      std::vector<int> expected_mines;
+      for (int mine : game_map.mines) {
+        if (reachable.count(mine))
+          expected_mines.push_back(mine);
+      }
+      std::vector<int> mines =
+          scorer.GetConnectedMineList(punter_id, river.source);
+      std::sort(expected_mines.begin(), expected_mines.end());
+      std::sort(mines.begin(), mines.end());
+      EXPECT_EQ(expected_mines, mines);
+    }
+  }
+}
+
+TEST(ScorerTest, SaveAndLoad) {
+  std::mt19937 rng(6);
+  const int kNumPunters = 2;
+  GameMap game_map = MakeRandomMap(60, 80, 4, &rng);
+  Scorer scorer;
+  scorer.Initialize(kNumPunters, game_map);
+  scorer.AddFuture(0, {Future{game_map.mines[0], game_map.sites[5].id},
+                       Future{game_map.mines[1], game_map.sites[9].id}});
+
+  const size_t num_rivers = game_map.rivers.size();
+  for (size_t i = 0; i < num_rivers / 2; ++i) {
+    const River& river = game_map.rivers[i];
+    scorer.Claim(i % kNumPunters, river.source, river.target);
+  }
+  // Leaves the distances of the other mines to be computed on demand.
+  scorer.GetDistanceToMine(game_map.mines[2], game_map.sites[0].id);
+
+  // Rolled-back claims leave nothing behind in the saved state.
+  ScorerProto proto;
+  scorer.Save(&proto);
+  scorer.Mark();
+  for (size_t i = num_rivers / 2; i < num_rivers; ++i) {
+    const River& river = game_map.rivers[i];
+    scorer.Claim(i % kNumPunters, river.source, river.target);
+  }
+  scorer.Rollback();
+  ScorerProto rolled_back_proto;
+  scorer.Save(&rolled_back_proto);
+  EXPECT_EQ(proto.SerializeAsString(), rolled_back_proto.SerializeAsString());
+
+  Scorer loaded;
+  loaded.Load(proto);
+  EXPECT_EQ(Snapshot(scorer, game_map, kNumPunters),
+            Snapshot(loaded, game_map, kNumPunters));
+
+  const Adjacency adjacency = MakeAdjacency(game_map.rivers);
+  for (int mine : game_map.mines) {
+    std::map<int, int> distances = Distances(adjacency, mine);
+    for (const Site& site : game_map.sites) {
+      EXPECT_EQ(distances[site.id], loaded.GetDistanceToMine(mine, site.id));
+    }
+  }
+
+  for (size_t i = num_rivers / 2; i < num_rivers; ++i) {
+    const River& river = game_map.rivers[i];
+    scorer.Claim(i % kNumPunters, river.source, river.target);
+    loaded.Claim(i % kNumPunters, river.source, river.target);
+    EXPECT_EQ(scorer.GetScore(0), loaded.GetScore(0));
+    EXPECT_EQ(scorer.GetScore(1), loaded.GetScore(1));
+  }
+}
+
+TEST(ScorerTest, ConnectedSiteList) {
+  std::mt19937 rng(7);
+  GameMap game_map = MakeRandomMap(40, 60, 3, &rng);
+  Scorer scorer;
+  scorer.Initialize(1, game_map);
+
+  auto check = [&scorer, &game_map](const std::vector<River>& claims) {
+    const Adjacency adjacency = MakeAdjacency(claims);
+    for (const Site& site : game_map.sites) {
+      std::vector<int> expected;
+      for (const auto& entry : Distances(adjacency, site.id))
+        expected.push_back(entry.first);
+      std::vector<int> sites = scorer.GetConnectedSiteList(0, site.id);
+      std::sort(sites.begin(), sites.end());
+      EXPECT_EQ(expected, sites);
+    }
+  };
+
+  std::vector<River> claims;
+  const size_t num_rivers = game_map.rivers.size();
+  for (size_t i = 0; i < num_rivers / 2; ++i) {
+    const River& river = game_map.rivers[i];
+    scorer.Claim(0, river.source, river.target);
+    claims.push_back(river);
+  }
+  check(claims);
+
+  // Member lists are split again by a rollback.
+  scorer.Mark();
+  for (size_t i = num_rivers / 2; i < num_rivers; ++i) {
+    const River& river = game_map.rivers[i];
+    scorer.Claim(0, river.source, river.target);
+  }
+  EXPECT_EQ(game_map.sites.size(),
+            scorer.GetConnectedSiteList(0, game_map.sites[0].id).size());
+  scorer.Rollback();
+  check(claims);
+}
+
+TEST(ScorerTest, NoMines) {
+  GameMap game_map = MakePathMap(4, {});
+  Scorer scorer;
+  scorer.Initialize(2, game_map);
+
+  EXPECT_EQ(0, scorer.TryClaim(0, 0, 1));
+  EXPECT_EQ(std::vector<int>({0, 0, 0}),
+            scorer.TryClaimAll(0, game_map.rivers));
+
+  scorer.Mark();
+  scorer.Claim(0, 0, 1);
+  scorer.Claim(0, 1, 2);
+  EXPECT_TRUE(scorer.IsConnected(0, 0, 2));
+  EXPECT_EQ(0, scorer.GetScore(0));
+  scorer.Rollback();
+  EXPECT_FALSE(scorer.IsConnected(0, 0, 1));
+
+  scorer.Claim(0, 0, 1);
+  scorer.Claim(1, 2, 3);
+  EXPECT_EQ(0, scorer.GetScore(0));
+  EXPECT_EQ(0, scorer.GetScore(1));
+  EXPECT_TRUE(scorer.GetConnectedMineList(0, 0).empty());
+
+  ScorerProto proto;
+  scorer.Save(&proto);
+  Scorer loaded;
+  loaded.Load(proto);
+  EXPECT_TRUE(loaded.IsConnected(0, 0, 1));
+  EXPECT_TRUE(loaded.IsConnected(1, 2, 3));
+  EXPECT_EQ(0, loaded.GetScore(0));
+}
+
+}  // namespace
+}  // namespace common
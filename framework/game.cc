@@ -1,6 +1,8 @@
 #include "framework/game.h"
 
 #include <stdio.h>
+#include <unistd.h>
+#include <algorithm>
 #include <cctype>
 
 #include "base/json/json_reader.h"
@@ -8,18 +10,338 @@
 #include "base/logging.h"
 #include "base/memory/ptr_util.h"
 #include "base/optional.h"
+#include "base/synchronization/waitable_event.h"
+#include "base/threading/simple_thread.h"
 #include "base/time/time.h"
+#include "common/json_decoder.h"
+#include "common/json_encoder.h"
 #include "common/protocol.h"
 #include "gflags/gflags.h"
 
 DEFINE_string(name, "", "Punter name.");
 DEFINE_bool(persistent, false, "If true, messages are repeatedly recieved");
+// Off by default: a worker of MetaPunter must time out for real, so that
+// MetaPunter falls back to its backup.
+DEFINE_bool(emergency_move, false,
+            "If true, send the best move so far when a turn is about to "
+            "time out, instead of letting the server force a pass. In the "
+            "offline mode, the process exits right after, without running "
+            "destructors.");
+DEFINE_int32(emergency_margin_ms, 50,
+             "The emergency move is sent this long before the end of the "
+             "turn.");
+DEFINE_bool(ponder, false,
+            "If true, keep thinking on a background thread while waiting "
+            "for the next move message. Only with --persistent.");
 
 namespace framework {
 
-Game::Game(std::unique_ptr<Punter> punter)
-    : punter_(std::move(punter)) {}
-Game::~Game() = default;
+namespace {
+
+// Wraps the state of a turn that was answered by the watchdog. The punter
+// never finished the turn, so the next turn replays its moves on top of the
+// state it started from.
+const char kEmergencyKey[] = "emergency";
+
+std::string CreateEmergencyState(base::StringPiece state,
+                                 const std::vector<GameMove>& moves) {
+  common::JsonEncoder encoder;
+  encoder.BeginObject();
+  encoder.Key(kEmergencyKey);
+  encoder.BeginObject();
+  encoder.Key("moves");
+  common::GameMoves::WriteJson(moves, &encoder);
+  encoder.Key("state");
+  encoder.Raw(state);
+  encoder.EndObject();
+  encoder.EndObject();
+  return encoder.text();
+}
+
+// If |state| was written by the watchdog, points it to the original state
+// and prepends the moves it missed to |moves|. Otherwise leaves both as is.
+void UnwrapEmergencyState(base::StringPiece* state,
+                          std::vector<GameMove>* moves) {
+  common::JsonDecoder decoder(*state);
+  bool found = false;
+  base::StringPiece original;
+  std::vector<GameMove> pending;
+  // Any state that is not an object is the punter's own.
+  bool ok = decoder.ReadObject([&](base::StringPiece key) {
+    if (key != kEmergencyKey)
+      return decoder.SkipValue(nullptr);
+    found = true;
+    return decoder.ReadObject([&](base::StringPiece key) {
+      if (key == "moves")
+        return common::ReadGameMoves(&decoder, &pending);
+      if (key == "state")
+        return decoder.SkipValue(&original);
+      return decoder.SkipValue(nullptr);
+    });
+  });
+  if (!ok || !found)
+    return;
+  CHECK(!original.empty());
+  moves->insert(moves->begin(), pending.begin(), pending.end());
+  *state = original;
+}
+
+// Sends the punter's emergency move if the turn is still running at
+// |fire_time|. In the offline mode the process _exit()s right after, since
+// the remaining computation is of no use; no destructors run.
+class Watchdog : public base::SimpleThread {
+ public:
+  Watchdog(Punter* punter,
+           const base::TimeTicks& fire_time,
+           base::StringPiece state,
+           std::atomic<bool>* responded)
+      : base::SimpleThread("watchdog"),
+        punter_(punter),
+        fire_time_(fire_time),
+        state_(state),
+        responded_(responded),
+        disarmed_(base::WaitableEvent::ResetPolicy::MANUAL,
+                  base::WaitableEvent::InitialState::NOT_SIGNALED) {}
+
+  void Run() override {
+    if (disarmed_.TimedWaitUntil(fire_time_))
+      return;
+    base::Optional<GameMove> move = punter_->GetEmergencyMove();
+    if (!move) {
+      LOG(WARNING) << "Turn is about to time out, with no move to send.";
+      return;
+    }
+    if (responded_->exchange(true))
+      return;
+
+    LOG(WARNING) << "Turn is about to time out. Sending the emergency move.";
+    punter_->Cancel();
+    common::JsonEncoder output;
+    output.BeginObject();
+    GameMove::WriteJsonMember(punter_->ToProtocolMove(move.value()), &output);
+    output.Key("state");
+    output.Raw(state_);
+    output.EndObject();
+    common::WriteMessage(stdout, output.text());
+    if (!FLAGS_persistent)
+      _exit(0);
+  }
+
+  void Disarm() {
+    disarmed_.Signal();
+    Join();
+  }
+
+ private:
+  Punter* const punter_;
+  const base::TimeTicks fire_time_;
+  // JSON text.
+  const base::StringPiece state_;
+  std::atomic<bool>* const responded_;
+  base::WaitableEvent disarmed_;
+
+  DISALLOW_COPY_AND_ASSIGN(Watchdog);
+};
+
+bool IsSameMove(const GameMove& a, const GameMove& b) {
+  if (a.type != b.type || a.punter_id != b.punter_id)
+    return false;
+  switch (a.type) {
+    case GameMove::Type::CLAIM:
+    case GameMove::Type::OPTION:
+      return a.source == b.source && a.target == b.target;
+    case GameMove::Type::PASS:
+      return true;
+    case GameMove::Type::SPLURGE:
+      return a.route == b.route;
+  }
+  return false;
+}
+
+// Compares move messages, ignoring the order of the punters.
+bool IsSameMoves(std::vector<GameMove> a, std::vector<GameMove> b) {
+  if (a.size() != b.size())
+    return false;
+  auto by_punter = [](const GameMove& x, const GameMove& y) {
+    return x.punter_id < y.punter_id;
+  };
+  std::sort(a.begin(), a.end(), by_punter);
+  std::sort(b.begin(), b.end(), by_punter);
+  for (size_t i = 0; i < a.size(); ++i) {
+    if (!IsSameMove(a[i], b[i]))
+      return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+// Thinks ahead while the other punters are thinking. If the punter predicts
+// the next move message, runs the turn for the prediction on a copy of the
+// punter, loaded from its state as in the offline mode, and keeps the copy
+// and its response. The punter itself is only asked for the prediction and
+// its state, so a miss leaves nothing behind. Then warms the punter's
+// caches.
+class Ponderer : public base::SimpleThread {
+ public:
+  // |my_move| is the move just sent, or null after the set up. |copy| is a
+  // fresh punter of the same kind to speculate on, or null not to
+  // speculate. A speculative turn gets |timeout|, like a real one.
+  Ponderer(Punter* punter,
+           std::unique_ptr<Punter> copy,
+           const base::Optional<GameMove>& my_move,
+           const base::TimeDelta& timeout)
+      : base::SimpleThread("ponderer"),
+        punter_(punter),
+        copy_(std::move(copy)),
+        my_move_(my_move),
+        timeout_(timeout) {}
+
+  void Run() override {
+    if (copy_ && my_move_)
+      Speculate();
+    if (!stopped_)
+      punter_->WarmUp();
+  }
+
+  // Cancels pondering and waits for it. Must be called before the punter is
+  // used on another thread.
+  void Stop() {
+    stopped_ = true;
+    punter_->Cancel();
+    if (copy_)
+      copy_->Cancel();
+    Join();
+  }
+
+  // If |moves| came as predicted, returns the response prepared for them,
+  // and moves the copy that prepared it, which is in the state after them,
+  // to |punter|. Called after Stop().
+  base::Optional<GameMove> TakeResponse(const std::vector<GameMove>& moves,
+                                        std::unique_ptr<Punter>* punter) {
+    if (!response_ || !IsSameMoves(predicted_, moves)) {
+      if (response_)
+        DLOG(INFO) << "Speculation missed";
+      return base::nullopt;
+    }
+    DLOG(INFO) << "Speculation hit";
+    *punter = std::move(copy_);
+    return response_;
+  }
+
+ private:
+  void Speculate() {
+    std::vector<GameMove> predicted = punter_->PredictMoves(my_move_.value());
+    if (predicted.empty() || stopped_)
+      return;
+    common::JsonEncoder state;
+    punter_->WriteStateJson(&state);
+    copy_->SetStateJson(state.text());
+    copy_->StartTurn(base::TimeTicks::Now(), timeout_);
+    // StartTurn() clears the cancellation, if Stop() raced with it.
+    if (stopped_)
+      copy_->Cancel();
+    GameMove response = copy_->Run(predicted);
+    // A cancelled search may have cut corners, so only keep a response that
+    // was complete before Stop().
+    if (!stopped_) {
+      response_ = response;
+      predicted_ = std::move(predicted);
+    }
+  }
+
+  Punter* const punter_;
+  std::unique_ptr<Punter> copy_;
+  const base::Optional<GameMove> my_move_;
+  const base::TimeDelta timeout_;
+  std::atomic<bool> stopped_{false};
+
+  std::vector<GameMove> predicted_;
+  base::Optional<GameMove> response_;
+
+  DISALLOW_COPY_AND_ASSIGN(Ponderer);
+};
+
+void Punter::SetStateJson(base::StringPiece json) {
+  std::unique_ptr<base::Value> state = base::JSONReader::Read(json);
+  CHECK(state) << "Invalid state";
+  SetState(std::move(state));
+}
+
+void Punter::WriteStateJson(common::JsonEncoder* encoder) {
+  encoder->Value(*GetState());
+}
+
+void Punter::StartTurn(const base::TimeTicks& start_time,
+                       const base::TimeDelta& timeout) {
+  end_time_ = start_time + timeout;
+  time_manager_.StartTurn(start_time, timeout);
+  cancelled_ = false;
+  base::AutoLock lock(best_move_lock_);
+  best_move_.reset();
+  fallback_move_.reset();
+}
+
+bool Punter::ShouldStop() const {
+  if (cancelled_)
+    return true;
+  // No deadline is set during set up.
+  if (time_manager_.hard_deadline().is_null())
+    return false;
+  return base::TimeTicks::Now() >= time_manager_.hard_deadline();
+}
+
+bool Punter::PastSoftDeadline() const {
+  if (time_manager_.soft_deadline().is_null())
+    return false;
+  return base::TimeTicks::Now() >= time_manager_.soft_deadline();
+}
+
+void Punter::SetBestMove(const GameMove& move) {
+  base::AutoLock lock(best_move_lock_);
+  best_move_ = move;
+}
+
+base::Optional<GameMove> Punter::GetBestMove() const {
+  base::AutoLock lock(best_move_lock_);
+  return best_move_;
+}
+
+void Punter::SetFallbackMove(const GameMove& move) {
+  base::AutoLock lock(best_move_lock_);
+  fallback_move_ = move;
+}
+
+base::Optional<GameMove> Punter::GetEmergencyMove() const {
+  base::AutoLock lock(best_move_lock_);
+  return best_move_ ? best_move_ : fallback_move_;
+}
+
+GameMove Punter::RunIterativeDeepening(
+    int max_depth,
+    const std::function<bool(int)>& search,
+    const GameMove& fallback) {
+  for (int depth = 1; depth <= max_depth && !ShouldStop(); ++depth) {
+    // The first depth always runs, so that there is an answer.
+    if (depth > 1 && PastSoftDeadline())
+      break;
+    if (!search(depth))
+      break;
+  }
+  base::Optional<GameMove> best_move = GetBestMove();
+  if (!best_move) {
+    LOG(WARNING) << "No move was found in time. Using the fallback.";
+    return fallback;
+  }
+  return best_move.value();
+}
+
+Game::Game(std::unique_ptr<Punter> punter, PunterFactory factory)
+    : punter_(std::move(punter)), factory_(std::move(factory)) {}
+Game::~Game() {
+  if (ponderer_)
+    ponderer_->Stop();
+}
 
 void Game::Run() {
   do {
@@ -31,30 +353,42 @@ void Game::Run() {
 bool Game::RunImpl() {
   DLOG(INFO) << "Game::Run";
 
-  punter_->OnInit();
+  std::unique_ptr<Ponderer> ponderer = std::move(ponderer_);
+  if (!ponderer)
+    punter_->OnInit();
 
   // Exchange name.
   DLOG(INFO) << "Exchanging name";
   {
     common::WritePing(stdout, FLAGS_name);
+    if (ponderer) {
+      // The server answers the ping when our turn comes. Keep pondering
+      // until then.
+      common::WaitForMessage(stdin);
+      ponderer->Stop();
+      punter_->OnInit();
+    }
     base::Optional<std::string> you_name = common::ReadPong(stdin);
     CHECK(you_name);
     CHECK_EQ(FLAGS_name, you_name.value());
   }
 
-  auto input = base::DictionaryValue::From(
-      common::ReadMessage(stdin, base::TimeDelta(), base::TimeTicks()));
+  base::StringPiece text;
+  CHECK(common::ReadMessageText(
+      stdin, base::TimeDelta(), base::TimeTicks(), &text));
   const base::TimeTicks start_time = base::TimeTicks::Now();
-  if (input->HasKey("punter")) {
+  common::ServerMessage input;
+  CHECK(common::DecodeServerMessage(text, &input)) << "Invalid message";
+  if (input.type == common::ServerMessage::Type::SET_UP) {
     // Set up.
-    common::SetUpData args = common::SetUpData::FromJson(*input);
+    const common::SetUpData& args = input.set_up;
     punter_->SetUp(args);
 
-    std::unique_ptr<base::Value> futures;
+    std::vector<Future> futures;
     if (args.settings.futures) {
       // Signal the punter that the futures feature is enabled and get the
       // futures to send.
-      futures = common::Futures::ToJson(punter_->GetFutures());
+      futures = punter_->GetFutures();
     }
 
     if (args.settings.splurges) {
@@ -67,29 +401,34 @@ bool Game::RunImpl() {
       punter_->EnableOptions();
     }
 
-    base::DictionaryValue output;
-
-    output.SetInteger("ready", args.punter_id);
+    common::JsonEncoder output;
+    output.BeginObject();
 
     if (args.settings.futures) {
-      output.Set("futures", std::move(futures));
+      output.Key("futures");
+      common::Futures::WriteJson(futures, &output);
     }
 
+    output.Key("ready");
+    output.Int(args.punter_id);
+
+    output.Key("state");
     if (FLAGS_persistent) {
-      output.Set("state", base::MakeUnique<base::Value>());
+      output.Null();
     } else {
-      output.Set("state", punter_->GetState());
+      punter_->WriteStateJson(&output);
     }
+    output.EndObject();
 
-    common::WriteMessage(stdout, output);
-  } else if (input->HasKey("stop")) {
+    common::WriteMessage(stdout, output.text());
+    punter_->OnFinish();
+    StartPondering(base::nullopt, base::TimeDelta());
+    return false;
+  } else if (input.type == common::ServerMessage::Type::STOP) {
     // Game was over.
 
 #if DCHECK_IS_ON()
-    const base::ListValue* moves_value;
-    CHECK(input->GetList("stop.moves", &moves_value));
-    std::vector<GameMove> moves = common::GameMoves::FromJson(*moves_value);
-    for (const auto& m : moves) {
+    for (const auto& m : input.moves) {
       switch (m.type) {
         case GameMove::Type::CLAIM:
           DLOG(INFO) << "move(claim): " << m.punter_id << ", "
@@ -108,55 +447,100 @@ bool Game::RunImpl() {
       }
     }
 
-    const base::ListValue* scores_value;
-    CHECK(input->GetList("stop.scores", &scores_value));
-    for (size_t i = 0; i < scores_value->GetSize(); ++i) {
-      const base::DictionaryValue* score_value;
-      CHECK(scores_value->GetDictionary(i, &score_value));
-      int punter_id;
-      CHECK(score_value->GetInteger("punter", &punter_id));
-      int score;
-      CHECK(score_value->GetInteger("score", &score));
-      DLOG(INFO) << "score: " << punter_id << ", " << score;
-    }
+    for (const auto& score : input.scores)
+      DLOG(INFO) << "score: " << score.punter_id << ", " << score.score;
 #endif
     punter_->OnFinish();
     return true;
   } else {
     // Play.
 
-    int timeout_ms;
-    if (!input->GetInteger("timeout_ms", &timeout_ms)) {
+    int timeout_ms = input.timeout_ms;
+    if (timeout_ms < 0) {
       timeout_ms = 1000;
     }
 
-    punter_->SetEndTime(
-        base::TimeDelta::FromMilliseconds(timeout_ms) + start_time);
-    const base::ListValue* moves_value;
-    CHECK(input->GetList("move.moves", &moves_value));
-    std::vector<GameMove> moves = common::GameMoves::FromJson(*moves_value);
+    const base::TimeDelta timeout =
+        base::TimeDelta::FromMilliseconds(timeout_ms);
+    const base::TimeTicks end_time = start_time + timeout;
+    std::vector<GameMove>& moves = input.moves;
 
+    base::Optional<GameMove> speculated;
+    if (ponderer) {
+      std::unique_ptr<Punter> copy;
+      speculated = ponderer->TakeResponse(moves, &copy);
+      if (speculated) {
+        // The copy has played this turn already, so it takes over.
+        punter_->OnFinish();
+        punter_ = std::move(copy);
+        punter_->OnInit();
+      }
+    }
+
+    punter_->StartTurn(start_time, timeout);
+
+    // State to send with an emergency move.
+    std::string emergency_state = "null";
     if (!FLAGS_persistent) {
-      std::unique_ptr<base::Value> state;
-      CHECK(input->Remove("state", &state));
-      punter_->SetState(std::move(state));
+      base::StringPiece state = input.state;
+      CHECK(!state.empty()) << "No state";
+      UnwrapEmergencyState(&state, &moves);
+      if (FLAGS_emergency_move)
+        emergency_state = CreateEmergencyState(state, moves);
+      punter_->SetStateJson(state);
     }
 
-    GameMove result = punter_->Run(moves);
+    responded_ = false;
+    std::unique_ptr<Watchdog> watchdog;
+    if (FLAGS_emergency_move) {
+      watchdog = base::MakeUnique<Watchdog>(
+          punter_.get(),
+          end_time - base::TimeDelta::FromMilliseconds(
+              FLAGS_emergency_margin_ms),
+          emergency_state, &responded_);
+      watchdog->Start();
+    }
 
-    std::unique_ptr<base::DictionaryValue> output = GameMove::ToJson(result);
+    GameMove result = speculated ? speculated.value() : punter_->Run(moves);
+
+    bool responded = responded_.exchange(true);
+    if (watchdog)
+      watchdog->Disarm();
+    if (responded) {
+      // The watchdog has already sent a move for this turn.
+      punter_->OnFinish();
+      return false;
+    }
 
+    common::JsonEncoder output;
+    output.BeginObject();
+    GameMove::WriteJsonMember(result, &output);
+
+    output.Key("state");
     if (FLAGS_persistent) {
-      output->Set("state", base::MakeUnique<base::Value>());
+      output.Null();
     } else {
-      output->Set("state", punter_->GetState());
+      punter_->WriteStateJson(&output);
     }
+    output.EndObject();
 
-    common::WriteMessage(stdout, *output);
+    common::WriteMessage(stdout, output.text());
+    punter_->OnFinish();
+    StartPondering(result, timeout);
+    return false;
   }
+}
 
-  punter_->OnFinish();
-  return false;
+void Game::StartPondering(const base::Optional<GameMove>& my_move,
+                          const base::TimeDelta& timeout) {
+  if (!FLAGS_ponder || !FLAGS_persistent)
+    return;
+  std::unique_ptr<Punter> copy;
+  if (factory_ && my_move)
+    copy = factory_();
+  ponderer_ = base::MakeUnique<Ponderer>(
+      punter_.get(), std::move(copy), my_move, timeout);
+  ponderer_->Start();
 }
 
 }  // framework
@@ -1,20 +1,28 @@
 #ifndef FRAMEWORK_GAME_H_
 #define FRAMEWORK_GAME_H_
 
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "base/macros.h"
+#include "base/optional.h"
+#include "base/strings/string_piece.h"
+#include "base/synchronization/lock.h"
 #include "base/time/time.h"
 #include "base/values.h"
 #include "common/game_data.h"
+#include "common/json_encoder.h"
+#include "framework/time_manager.h"
 
 namespace framework {
 
 using Site = common::Site;
 using River = common::River;
 using GameMap = common::GameMap;
+using SiteIndexMap = common::SiteIndexMap;
 using GameMove = common::GameMove;
 using Future = common::Future;
 
@@ -22,7 +30,8 @@ class Punter {
  public:
   virtual ~Punter() = default;
 
-  // Called for each run, before ping message exchanging.
+  // Called for each run, before ping message exchanging. While pondering
+  // (see below), called once pondering has stopped, after sending the ping.
   virtual void OnInit() {}
 
   virtual void SetUp(const common::SetUpData& args) = 0;
@@ -37,34 +46,121 @@ class Punter {
   virtual void SetState(std::unique_ptr<base::Value> state) = 0;
   virtual std::unique_ptr<base::Value> GetState() = 0;
 
-  void SetEndTime(const base::TimeTicks& end_time) {
-    end_time_ = end_time;
-  }
+  // The state as JSON text, which is what Game actually exchanges. By
+  // default they go through SetState() and GetState(). Wrappers that only
+  // relay the state of other punters override them to pass it on as text.
+  virtual void SetStateJson(base::StringPiece json);
+  virtual void WriteStateJson(common::JsonEncoder* encoder);
+
+  // Starts a turn that times out |timeout| after |start_time|. Also clears
+  // the best move and the cancellation of the previous turn.
+  void StartTurn(const base::TimeTicks& start_time,
+                 const base::TimeDelta& timeout);
 
   // Maybe non-positive, in case of timeout.
   base::TimeDelta approxy_remaining_time() {
     return end_time_ - base::TimeTicks::Now();
   }
 
+  // Anytime API. A search records the best move found so far with
+  // SetBestMove(), and polls ShouldStop() at points where it can give up.
+  // Cancel(), SetBestMove() and GetBestMove() may be called from any thread.
+
+  // Returns true if Cancel() was called, or the hard deadline of the turn
+  // has passed. See TimeManager.
+  bool ShouldStop() const;
+  // Returns true if the soft deadline of the turn has passed, so no new
+  // work (such as a deeper iteration) should be started.
+  bool PastSoftDeadline() const;
+  void Cancel() { cancelled_ = true; }
+  bool IsCancelled() const { return cancelled_; }
+
+  void SetBestMove(const GameMove& move);
+  base::Optional<GameMove> GetBestMove() const;
+
+  // Sets a cheap move to send if the turn overruns before any best move is
+  // set. Game sends GetEmergencyMove() (the best move, else this one) from
+  // its watchdog thread.
+  void SetFallbackMove(const GameMove& move);
+  base::Optional<GameMove> GetEmergencyMove() const;
+
+  // Converts a move recorded above into the form sent to the server. Called
+  // on the watchdog thread while Run() may still be running, so this must
+  // only read state that Run() does not modify.
+  virtual GameMove ToProtocolMove(const GameMove& move) const {
+    return move;
+  }
+
+  // Calls |search| with depth 1, 2, ..., |max_depth| until it returns false,
+  // ShouldStop(), or PastSoftDeadline() before a new depth. |search| should
+  // call SetBestMove() for each depth it completes. Returns the best move,
+  // or |fallback| if none was set.
+  GameMove RunIterativeDeepening(int max_depth,
+                                 const std::function<bool(int)>& search,
+                                 const GameMove& fallback);
+
+  // Pondering (--ponder, persistent mode only). After replying, Game calls
+  // PredictMoves() and then WarmUp() on a background thread while the other
+  // punters think. Game Cancel()s and joins that thread before it touches
+  // the punter again, so these may use and fill the punter's caches without
+  // locking, but should poll IsCancelled() to return promptly.
+
+  // Returns the likely content of the next move message, given that we
+  // have just sent |my_move|, or an empty list not to speculate. If Game has
+  // a PunterFactory, it runs Run() on the prediction in advance, on a new
+  // punter loaded with SetStateJson() from this one's state. If the
+  // prediction comes true, that punter replaces this one. So speculation
+  // relies on the state to be complete, as the offline mode does.
+  virtual std::vector<GameMove> PredictMoves(const GameMove& my_move) {
+    return {};
+  }
+  // Precomputes whatever the next Run() is likely to need.
+  virtual void WarmUp() {}
+
  protected:
   Punter() = default;
 
+  TimeManager* time_manager() { return &time_manager_; }
+  const TimeManager* time_manager() const { return &time_manager_; }
+
  private:
   base::TimeTicks end_time_;
+  TimeManager time_manager_;
+  std::atomic<bool> cancelled_{false};
+  mutable base::Lock best_move_lock_;
+  base::Optional<GameMove> best_move_;
+  base::Optional<GameMove> fallback_move_;
   DISALLOW_COPY_AND_ASSIGN(Punter);
 };
 
+class Ponderer;
+
 class Game {
  public:
-  Game(std::unique_ptr<Punter> punter);
+  // Makes a new punter of the same kind as the one played.
+  using PunterFactory = std::function<std::unique_ptr<Punter>()>;
+
+  // Without |factory|, pondering only warms the punter up.
+  explicit Game(std::unique_ptr<Punter> punter,
+                PunterFactory factory = PunterFactory());
   ~Game();
 
   void Run();
 
  private:
   bool RunImpl();
+  // Starts |ponderer_| after replying |my_move| (null for the set up), if
+  // enabled. The punter must not be touched again until it is stopped.
+  void StartPondering(const base::Optional<GameMove>& my_move,
+                      const base::TimeDelta& timeout);
 
   std::unique_ptr<Punter> punter_;
+  const PunterFactory factory_;
+  // Set by whichever of the main thread and the watchdog responds to the
+  // current turn first.
+  std::atomic<bool> responded_{false};
+  // Runs between our reply and the next message, if --ponder.
+  std::unique_ptr<Ponderer> ponderer_;
 
   DISALLOW_COPY_AND_ASSIGN(Game);
 };
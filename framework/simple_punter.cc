@@ -1,5 +1,6 @@
 #include "framework/simple_punter.h"
 
+#include <algorithm>
 #include <queue>
 
 #include "base/base64.h"
@@ -9,105 +10,102 @@
 
 namespace framework {
 
+namespace {
+
+// Key of the river between two sites, independent of their order.
+uint64_t RiverKey(int site_index1, int site_index2) {
+  if (site_index1 > site_index2)
+    std::swap(site_index1, site_index2);
+  return (static_cast<uint64_t>(site_index1) << 32) |
+      static_cast<uint32_t>(site_index2);
+}
+
+}  // namespace
+
 SimplePunter::SimplePunter() = default;
 SimplePunter::~SimplePunter() = default;
 
 GameMove SimplePunter::Run(const std::vector<GameMove>& moves) {
-  proto_.set_num_remaining_turns(
-      static_cast<int>(proto_.num_remaining_turns() - moves.size()));
-  common::Scorer scorer(proto_.mutable_scorer());
+  num_remaining_turns_ -= static_cast<int>(moves.size());
   recent_updated_.clear();
   for (const auto& move : moves) {
     switch (move.type) {
       case GameMove::Type::PASS: {
         if (move.punter_id == punter_id_)
-          proto_.set_pass_count(proto_.pass_count() + 1);
+          ++pass_count_;
         break;
       }
       case GameMove::Type::CLAIM: {
         if (move.punter_id == punter_id_)
-          proto_.set_pass_count(0);
+          pass_count_ = 0;
 
         // Must use original site ids.
-        scorer.Claim(move.punter_id, move.source, move.target);
-
-        int source_idx = FindSiteIdxFromSiteId(move.source);
-        int target_idx = FindSiteIdxFromSiteId(move.target);
-
-        for (Edge& edge : edges_[source_idx]) {
-          if (edge.site != target_idx)
-            continue;
-          RiverProto* r = rivers_->Mutable(edge.river);
-          DCHECK(r->punter() == -1);
-          r->set_punter(move.punter_id);
-          recent_updated_.push_back(edge.river);
-          break;
+        scorer_.Claim(move.punter_id, move.source, move.target);
+
+        int river_index = FindRiver(FindSiteIdxFromSiteId(move.source),
+                                    FindSiteIdxFromSiteId(move.target));
+        if (river_index >= 0) {
+          DCHECK(rivers_->Get(river_index).punter() == -1);
+          ApplyClaim(move.punter_id, river_index);
         }
         break;
       }
       case GameMove::Type::OPTION: {
         if (move.punter_id == punter_id_) {
-          proto_.set_pass_count(0);
+          pass_count_ = 0;
         }
-        proto_.set_options_remaining(punter_id_, proto_.options_remaining(punter_id_) - 1);
+        --options_remaining_[punter_id_];
 
         // Must use original site ids.
-        scorer.Option(move.punter_id, move.source, move.target);
-
-        int source_idx = FindSiteIdxFromSiteId(move.source);
-        int target_idx = FindSiteIdxFromSiteId(move.target);
-
-        bool done = false;
-        for (Edge& edge : edges_[source_idx]) {
-          if (edge.site != target_idx)
-            continue;
-          RiverProto* r = rivers_->Mutable(edge.river);
-          DCHECK(r->punter() != -1);
-          DCHECK(r->option_punter() == -1);
-          r->set_option_punter(move.punter_id);
-          recent_updated_.push_back(edge.river);
-          done = true;
-          break;
-        }
-        DCHECK(done);
+        scorer_.Option(move.punter_id, move.source, move.target);
+
+        int river_index = FindRiver(FindSiteIdxFromSiteId(move.source),
+                                    FindSiteIdxFromSiteId(move.target));
+        DCHECK_GE(river_index, 0);
+        DCHECK(rivers_->Get(river_index).punter() != -1);
+        DCHECK(rivers_->Get(river_index).option_punter() == -1);
+        ApplyOption(move.punter_id, river_index);
         break;
       }
       case GameMove::Type::SPLURGE: {
         if (move.punter_id == punter_id_)
-          proto_.set_pass_count(0);
+          pass_count_ = 0;
 
         // Must use original site ids.
-        scorer.Splurge(move.punter_id, move.route);
+        scorer_.Splurge(move.punter_id, move.route);
 
+        std::vector<int> river_indexes;
+        river_indexes.reserve(move.route.size());
         for (size_t i = 0; i + 1U < move.route.size(); ++i) {
-          int source_idx = FindSiteIdxFromSiteId(move.route[i]);
-          int target_idx = FindSiteIdxFromSiteId(move.route[i + 1]);
-
-          bool done = false;
-          for (Edge& edge : edges_[source_idx]) {
-            if (edge.site != target_idx)
-              continue;
-            RiverProto* r = rivers_->Mutable(edge.river);
-            if (r->punter() == -1) {
-              r->set_punter(move.punter_id);
-            } else {
-              DCHECK(r->option_punter() == -1);
-              r->set_option_punter(move.punter_id);
-            }
-            done = true;
-            recent_updated_.push_back(edge.river);
-            break;
+          int river_index =
+              FindRiver(FindSiteIdxFromSiteId(move.route[i]),
+                        FindSiteIdxFromSiteId(move.route[i + 1]));
+          DCHECK_GE(river_index, 0);
+          if (rivers_->Get(river_index).punter() == -1) {
+            ApplyClaim(move.punter_id, river_index);
+          } else {
+            DCHECK(rivers_->Get(river_index).option_punter() == -1);
+            ApplyOption(move.punter_id, river_index);
           }
-          DCHECK(done);
+          river_indexes.push_back(river_index);
         }
+        OnSplurge(move.punter_id, river_indexes);
         break;
       }
     }
   }
 
+  SetFallbackMove(CreateFallbackMove());
+
+  // Our own turns, rounded up.
+  time_manager()->StartSearch(
+      (num_remaining_turns_ + num_punters_ - 1) / num_punters_,
+      (rivers_->size() + num_punters_ - 1) / num_punters_);
+
   //LOG(INFO) << "GetOptionsRemaining(): " << GetOptionsRemaining();
   //LOG(INFO) << "GetNumSplurgableEdges(): " << GetNumSplurgableEdges();
   GameMove out_move = Run();
+  time_manager()->EndSearch();
 
   // Translate site indexes to the original id.
   InternalGameMoveToExternal(&out_move);
@@ -121,89 +119,184 @@ GameMove SimplePunter::Run(const std::vector<GameMove>& moves) {
   return out_move;
 }
 
-void SimplePunter::SetAliasesToProto() {
-  sites_ = proto_.mutable_game_map()->mutable_sites();
-  rivers_ = proto_.mutable_game_map()->mutable_rivers();
-  mines_ = proto_.mutable_game_map()->mutable_mines();
+GameMove SimplePunter::ToProtocolMove(const GameMove& move) const {
+  GameMove result = move;
+  InternalGameMoveToExternal(&result);
+  return result;
 }
 
-void SimplePunter::SetUp(const common::SetUpData& args) {
-  punter_id_ = args.punter_id;
-  num_punters_ = args.num_punters;
-
-  GameMapProto* game_map_proto = proto_.mutable_game_map();
-
-  const GameMap& game_map = args.game_map;
-  for (const Site& s : game_map.sites) {
-    SiteProto* site_proto = game_map_proto->add_sites();
-    site_proto->set_id(s.id);
+std::vector<GameMove> SimplePunter::PredictMoves(const GameMove& my_move) {
+  // |my_move| is not applied yet, so leave out the rivers it takes.
+  std::vector<int> taken;
+  if (my_move.type == GameMove::Type::CLAIM) {
+    taken.push_back(FindRiver(FindSiteIdxFromSiteId(my_move.source),
+                              FindSiteIdxFromSiteId(my_move.target)));
+  } else if (my_move.type == GameMove::Type::SPLURGE) {
+    for (size_t i = 0; i + 1U < my_move.route.size(); ++i) {
+      taken.push_back(FindRiver(FindSiteIdxFromSiteId(my_move.route[i]),
+                                FindSiteIdxFromSiteId(my_move.route[i + 1])));
+    }
   }
-
-  for (const River& r : game_map.rivers) {
-    RiverProto* river_proto = game_map_proto->add_rivers();
-    river_proto->set_source(r.source);
-    river_proto->set_target(r.target);
-    river_proto->set_punter(-1);
-    river_proto->set_option_punter(-1);
+  std::vector<int> free_rivers;
+  for (int i = 0; i < rivers_->size(); ++i) {
+    if (rivers_->Get(i).punter() == -1 &&
+        std::find(taken.begin(), taken.end(), i) == taken.end()) {
+      free_rivers.push_back(i);
+    }
   }
 
-  for (const int mine : game_map.mines) {
-    MineProto* mine_proto = game_map_proto->add_mines();
-    mine_proto->set_site(mine);
+  std::vector<GameMove> result = {my_move};
+  for (int i = 1; i < num_punters_; ++i) {
+    if (IsCancelled())
+      return {};
+    const int punter_id = (punter_id_ + i) % num_punters_;
+    if (free_rivers.empty()) {
+      result.push_back(GameMove::Pass(punter_id));
+      continue;
+    }
+    std::vector<int> gains = TryClaimAll(punter_id, free_rivers);
+    size_t best = std::max_element(gains.begin(), gains.end()) - gains.begin();
+    const RiverState& river = rivers_->Get(free_rivers[best]);
+    result.push_back(GameMove::Claim(
+        punter_id, site_ids_[river.source()], site_ids_[river.target()]));
+    free_rivers.erase(free_rivers.begin() + best);
   }
+  return result;
+}
 
-  SetAliasesToProto();
+void SimplePunter::WarmUp() {
+  // Distances to each mine are computed on first use.
+  for (int i = 0; i < mines_->size() && !IsCancelled(); ++i)
+    dist_to_mine(mines_->Get(i).site(), i);
+  if (!IsCancelled())
+    GetOwnedEdges(punter_id_);
+}
 
-  std::sort(sites_->begin(), sites_->end(),
-            [](const SiteProto& lhs, const SiteProto& rhs) {
-              return lhs.id() < rhs.id();
-            });
-  for (int i = 0; i < rivers_->size(); ++i) {
-    rivers_->Mutable(i)->set_source(
-        FindSiteIdxFromSiteId(rivers_->Get(i).source()));
-    rivers_->Mutable(i)->set_target(
-        FindSiteIdxFromSiteId(rivers_->Get(i).target()));
+GameMove SimplePunter::CreateFallbackMove() const {
+  for (const RiverState& river : *rivers_) {
+    if (river.punter() == -1)
+      return CreateClaim(river.source(), river.target());
   }
-  for (int i = 0; i < mines_->size(); ++i) {
-    mines_->Mutable(i)->set_site(
-        FindSiteIdxFromSiteId(mines_->Get(i).site()));
+  return CreatePass();
+}
+
+void SimplePunter::SetUp(const common::SetUpData& args) {
+  punter_id_ = args.punter_id;
+  num_punters_ = args.num_punters;
+
+  const GameMap& game_map = args.game_map;
+  site_ids_.clear();
+  site_ids_.reserve(game_map.sites.size());
+  for (const Site& s : game_map.sites)
+    site_ids_.push_back(s.id);
+  site_index_map_ = game_map.site_index_map;
+
+  river_list_.Clear();
+  river_list_.Reserve(game_map.rivers.size());
+  for (const River& r : game_map.rivers) {
+    river_list_.Add(RiverState(FindSiteIdxFromSiteId(r.source),
+                               FindSiteIdxFromSiteId(r.target)));
   }
 
-  GenerateAdjacencyList();
+  mine_list_.Clear();
+  mine_list_.Reserve(game_map.mines.size());
+  for (const int mine : game_map.mines)
+    mine_list_.Add(MineState(FindSiteIdxFromSiteId(mine)));
 
-  proto_.set_punter_id(punter_id_);
-  proto_.set_num_punters(num_punters_);
+  GenerateAdjacencyList();
 
   // -1 since the initial play contains fake pass.
-  proto_.set_pass_count(-1);
+  pass_count_ = -1;
 
-  for(int i = 0; i < num_punters_; ++i) {
-    proto_.add_options_remaining(args.settings.options ? game_map.mines.size() : 0);
-  }
+  options_remaining_.assign(
+      num_punters_, args.settings.options ? game_map.mines.size() : 0);
 
-  proto_.set_num_remaining_turns(rivers_->size());
+  num_remaining_turns_ = rivers_->size();
 
-  common::Scorer(proto_.mutable_scorer()).Initialize(
-      num_punters_, args.game_map);
+  scorer_.Initialize(num_punters_, args.game_map);
 }
 
 int SimplePunter::FindSiteIdxFromSiteId(int id) const {
-  auto it = std::lower_bound(sites_->begin(), sites_->end(), id,
-      [](const SiteProto& site, int val) {
-        return site.id() < val;
-      });
-  DCHECK(it != sites_->end() && it->id() == id);
-  return it - sites_->begin();
+  return site_index_map_.Get(id);
+}
+
+void SimplePunter::ApplyClaim(int punter_id, int river_index) {
+  rivers_->Mutable(river_index)->set_punter(punter_id);
+  AddOwnedEdge(punter_id, river_index);
+  recent_updated_.push_back(river_index);
+  OnRiverClaimed(punter_id, river_index);
+}
+
+void SimplePunter::ApplyOption(int punter_id, int river_index) {
+  rivers_->Mutable(river_index)->set_option_punter(punter_id);
+  AddOwnedEdge(punter_id, river_index);
+  recent_updated_.push_back(river_index);
+  OnRiverOptioned(punter_id, river_index);
+}
+
+void SimplePunter::AddOwnedEdge(int punter_id, int river_index) {
+  if (punter_id >= static_cast<int>(owned_edges_.size()) ||
+      owned_edges_[punter_id].empty()) {
+    // Not built yet. GetOwnedEdges() will see the river.
+    return;
+  }
+  std::vector<std::vector<Edge>>& owned = owned_edges_[punter_id];
+  const RiverState& river = rivers_->Get(river_index);
+  owned[river.source()].push_back(Edge{river.target(), river_index});
+  owned[river.target()].push_back(Edge{river.source(), river_index});
+}
+
+const std::vector<std::vector<SimplePunter::Edge>>&
+SimplePunter::GetOwnedEdges(int punter_id) const {
+  DCHECK_GE(punter_id, 0);
+  if (owned_edges_.size() < static_cast<size_t>(num_punters_))
+    owned_edges_.resize(num_punters_);
+  std::vector<std::vector<Edge>>& owned = owned_edges_[punter_id];
+  if (owned.empty()) {
+    owned.resize(num_sites());
+    for (int i = 0; i < rivers_->size(); ++i) {
+      const RiverState& river = rivers_->Get(i);
+      if (river.punter() != punter_id && river.option_punter() != punter_id)
+        continue;
+      owned[river.source()].push_back(Edge{river.target(), i});
+      owned[river.target()].push_back(Edge{river.source(), i});
+    }
+  }
+  return owned;
+}
+
+void SimplePunter::VisitClaimedSites(int punter_id, int site_index,
+                                     std::vector<bool>* visited) const {
+  if ((*visited)[site_index])
+    return;
+  const std::vector<std::vector<Edge>>& owned = GetOwnedEdges(punter_id);
+  std::vector<int> stack = {site_index};
+  (*visited)[site_index] = true;
+  while (!stack.empty()) {
+    int site = stack.back();
+    stack.pop_back();
+    for (const Edge& e : owned[site]) {
+      if ((*visited)[e.site] || rivers_->Get(e.river).punter() != punter_id)
+        continue;
+      (*visited)[e.site] = true;
+      stack.push_back(e.site);
+    }
+  }
 }
 
 void SimplePunter::GenerateAdjacencyList() {
-  edges_.resize(sites_->size());
+  owned_edges_.clear();
+  edges_.clear();
+  edges_.resize(site_ids_.size());
+  river_index_map_.clear();
+  river_index_map_.reserve(rivers_->size());
   for (int i = 0; i < rivers_->size(); ++i) {
-    const RiverProto& river = rivers_->Get(i);
+    const RiverState& river = rivers_->Get(i);
     int a = river.source();
     int b = river.target();
     edges_[a].push_back(Edge{b, i});
     edges_[b].push_back(Edge{a, i});
+    river_index_map_.emplace(RiverKey(a, b), i);
   }
 }
 
@@ -221,20 +314,238 @@ void SimplePunter::SetState(std::unique_ptr<base::Value> state_in) {
 
 void SimplePunter::SetStateFromProto(std::unique_ptr<GameStateProto> state_in) {
   proto_ = *std::move(state_in);
-  SetAliasesToProto();
+  LoadStateFromProto(proto_);
+
+  // Keep only the fields owned by sub classes.
+  proto_.clear_punter_id();
+  proto_.clear_num_punters();
+  proto_.clear_game_map();
+  proto_.clear_scorer();
+  proto_.clear_can_splurge();
+  proto_.clear_can_option();
+  proto_.clear_pass_count();
+  proto_.clear_options_remaining();
+  proto_.clear_num_remaining_turns();
+  proto_.clear_compact_state();
+  proto_.clear_scorer_future_sources();
+  proto_.clear_scorer_future_targets();
+  proto_.clear_time_manager();
+}
 
-  punter_id_ = proto_.punter_id();
-  num_punters_ = proto_.num_punters();
+void SimplePunter::LoadStateFromProto(const GameStateProto& proto) {
+  punter_id_ = proto.punter_id();
+  num_punters_ = proto.num_punters();
+
+  can_splurge_ = proto.has_can_splurge() && proto.can_splurge();
+  can_option_ = proto.has_can_option() && proto.can_option();
+  pass_count_ = proto.pass_count();
+  options_remaining_.assign(
+      proto.options_remaining().begin(), proto.options_remaining().end());
+  num_remaining_turns_ = proto.num_remaining_turns();
+  time_manager()->Load(proto.time_manager());
+
+  DCHECK_EQ(proto.scorer_future_sources_size(),
+            proto.scorer_future_targets_size());
+  futures_.clear();
+  for (int i = 0; i < proto.scorer_future_sources_size(); ++i) {
+    futures_.push_back(
+        {proto.scorer_future_sources(i), proto.scorer_future_targets(i)});
+  }
 
-  can_splurge_ = proto_.has_can_splurge() && proto_.can_splurge();
-  can_option_ = proto_.has_can_option() && proto_.can_option();
+  if (proto.has_compact_state()) {
+    LoadCompactState(proto.compact_state());
+    GenerateAdjacencyList();
+    RecomputeScorer();
+    return;
+  }
+
+  const GameMapProto& game_map = proto.game_map();
+  site_ids_.clear();
+  site_ids_.reserve(game_map.sites_size());
+  for (const SiteProto& site : game_map.sites())
+    site_ids_.push_back(site.id());
+  site_index_map_.Build(site_ids_);
+
+  river_list_.Clear();
+  river_list_.Reserve(game_map.rivers_size());
+  for (const RiverProto& river_proto : game_map.rivers()) {
+    RiverState river(river_proto.source(), river_proto.target());
+    river.set_punter(river_proto.punter());
+    river.set_option_punter(river_proto.option_punter());
+    river_list_.Add(river);
+  }
+
+  mine_list_.Clear();
+  mine_list_.Reserve(game_map.mines_size());
+  for (const MineProto& mine : game_map.mines())
+    mine_list_.Add(MineState(mine.site()));
+
+  scorer_.Load(proto.scorer());
 
   GenerateAdjacencyList();
 }
 
+void SimplePunter::LoadCompactState(const CompactStateProto& proto) {
+  site_ids_.clear();
+  site_ids_.reserve(proto.site_id_gaps_size());
+  int site_id = 0;
+  for (int gap : proto.site_id_gaps()) {
+    site_id += gap;
+    site_ids_.push_back(site_id);
+  }
+  site_index_map_.Build(site_ids_);
+
+  DCHECK_EQ(0, proto.river_sites_size() % 2);
+  river_list_.Clear();
+  river_list_.Reserve(proto.river_sites_size() / 2);
+  for (int i = 0; i + 1 < proto.river_sites_size(); i += 2)
+    river_list_.Add(RiverState(proto.river_sites(i), proto.river_sites(i + 1)));
+
+  mine_list_.Clear();
+  mine_list_.Reserve(proto.mine_sites_size());
+  for (int mine_site : proto.mine_sites())
+    mine_list_.Add(MineState(mine_site));
+
+  DCHECK_EQ(proto.claimed_river_gaps_size(),
+            proto.claimed_river_punters_size());
+  int river_index = 0;
+  for (int i = 0; i < proto.claimed_river_gaps_size(); ++i) {
+    river_index += proto.claimed_river_gaps(i);
+    river_list_.Mutable(river_index)->set_punter(
+        proto.claimed_river_punters(i));
+  }
+  DCHECK_EQ(proto.optioned_river_gaps_size(),
+            proto.optioned_river_punters_size());
+  river_index = 0;
+  for (int i = 0; i < proto.optioned_river_gaps_size(); ++i) {
+    river_index += proto.optioned_river_gaps(i);
+    river_list_.Mutable(river_index)->set_option_punter(
+        proto.optioned_river_punters(i));
+  }
+}
+
+void SimplePunter::SaveCompactState(CompactStateProto* proto) const {
+  proto->Clear();
+  proto->mutable_site_id_gaps()->Reserve(site_ids_.size());
+  int prev_site_id = 0;
+  for (int site_id : site_ids_) {
+    proto->add_site_id_gaps(site_id - prev_site_id);
+    prev_site_id = site_id;
+  }
+  proto->mutable_river_sites()->Reserve(rivers_->size() * 2);
+  for (const RiverState& river : *rivers_) {
+    proto->add_river_sites(river.source());
+    proto->add_river_sites(river.target());
+  }
+  proto->mutable_mine_sites()->Reserve(mines_->size());
+  for (const MineState& mine : *mines_)
+    proto->add_mine_sites(mine.site());
+
+  int prev_claimed = 0;
+  int prev_optioned = 0;
+  for (int i = 0; i < rivers_->size(); ++i) {
+    const RiverState& river = rivers_->Get(i);
+    if (river.punter() != -1) {
+      proto->add_claimed_river_gaps(i - prev_claimed);
+      proto->add_claimed_river_punters(river.punter());
+      prev_claimed = i;
+    }
+    if (river.option_punter() != -1) {
+      proto->add_optioned_river_gaps(i - prev_optioned);
+      proto->add_optioned_river_punters(river.option_punter());
+      prev_optioned = i;
+    }
+  }
+}
+
+void SimplePunter::RecomputeScorer() {
+  GameMap game_map;
+  game_map.sites.reserve(site_ids_.size());
+  for (int site_id : site_ids_)
+    game_map.sites.push_back({site_id});
+  game_map.site_index_map = site_index_map_;
+  game_map.rivers.reserve(rivers_->size());
+  for (const RiverState& river : *rivers_)
+    game_map.rivers.push_back({site_ids_[river.source()],
+                               site_ids_[river.target()]});
+  game_map.mines.reserve(mines_->size());
+  for (const MineState& mine : *mines_)
+    game_map.mines.push_back(site_ids_[mine.site()]);
+  scorer_.Initialize(num_punters_, game_map);
+
+  std::vector<Future> futures;
+  for (const Future& future : futures_)
+    futures.push_back({site_ids_[future.source], site_ids_[future.target]});
+  scorer_.AddFuture(punter_id_, futures);
+
+  // The score depends only on which rivers each punter holds, not on the
+  // order they were taken in.
+  for (const RiverState& river : *rivers_) {
+    int source = site_ids_[river.source()];
+    int target = site_ids_[river.target()];
+    if (river.punter() != -1)
+      scorer_.Claim(river.punter(), source, target);
+    if (river.option_punter() != -1)
+      scorer_.Option(river.option_punter(), source, target);
+  }
+}
+
+void SimplePunter::SaveStateToProto(
+    GameStateProto* proto, bool compact) const {
+  proto->set_punter_id(punter_id_);
+  proto->set_num_punters(num_punters_);
+
+  proto->set_can_splurge(can_splurge_);
+  proto->set_can_option(can_option_);
+  proto->set_pass_count(pass_count_);
+  proto->clear_options_remaining();
+  for (int options : options_remaining_)
+    proto->add_options_remaining(options);
+  proto->set_num_remaining_turns(num_remaining_turns_);
+  time_manager()->Save(proto->mutable_time_manager());
+
+  proto->clear_scorer_future_sources();
+  proto->clear_scorer_future_targets();
+  for (const Future& future : futures_) {
+    proto->add_scorer_future_sources(future.source);
+    proto->add_scorer_future_targets(future.target);
+  }
+
+  if (compact) {
+    proto->clear_game_map();
+    proto->clear_scorer();
+    SaveCompactState(proto->mutable_compact_state());
+    return;
+  }
+
+  proto->clear_compact_state();
+  GameMapProto* game_map = proto->mutable_game_map();
+  game_map->Clear();
+  game_map->mutable_sites()->Reserve(site_ids_.size());
+  for (int site_id : site_ids_)
+    game_map->add_sites()->set_id(site_id);
+  game_map->mutable_rivers()->Reserve(rivers_->size());
+  for (const RiverState& river : *rivers_) {
+    RiverProto* river_proto = game_map->add_rivers();
+    river_proto->set_source(river.source());
+    river_proto->set_target(river.target());
+    river_proto->set_punter(river.punter());
+    river_proto->set_option_punter(river.option_punter());
+  }
+  game_map->mutable_mines()->Reserve(mines_->size());
+  for (const MineState& mine : *mines_)
+    game_map->add_mines()->set_site(mine.site());
+
+  scorer_.Save(proto->mutable_scorer());
+}
+
 std::unique_ptr<base::Value> SimplePunter::GetState() {
   auto value = base::MakeUnique<base::DictionaryValue>();
-  const std::string binary = proto_.SerializeAsString();
+  // The offline state uses the compact encoding; the scorer is recomputed
+  // by the next SetState().
+  GameStateProto proto(proto_);
+  SaveStateToProto(&proto, true /* compact */);
+  const std::string binary = proto.SerializeAsString();
   std::string b64;
   base::Base64Encode(binary, &b64);
   value->SetString("proto", b64);
@@ -244,26 +555,23 @@ std::unique_ptr<base::Value> SimplePunter::GetState() {
 
 void SimplePunter::EnableSplurges() {
   can_splurge_ = true;
-
-  proto_.set_can_splurge(can_splurge_);
 }
 
 void SimplePunter::EnableOptions() {
   can_option_ = true;
-
-  proto_.set_can_option(can_option_);
 }
 
 std::vector<Future> SimplePunter::GetFutures() {
   // Conver to original id before returning.
   std::vector<Future> result = GetFuturesImpl();
+  futures_ = result;
   for (auto& future : result) {
-    future.source = sites_->Get(future.source).id();
-    future.target = sites_->Get(future.target).id();
+    future.source = site_ids_[future.source];
+    future.target = site_ids_[future.target];
   }
 
   // Update future.
-  common::Scorer(proto_.mutable_scorer()).AddFuture(punter_id_, result);
+  scorer_.AddFuture(punter_id_, result);
 
   return std::move(result);
 }
@@ -271,7 +579,7 @@ std::vector<Future> SimplePunter::GetFutures() {
 int SimplePunter::GetOptionsRemaining() const {
   if (!can_option_)
     return 0;
-  return proto_.options_remaining(punter_id_);
+  return options_remaining_[punter_id_];
 }
 
 std::vector<int> SimplePunter::GetOptionsRemainingAll() const {
@@ -280,13 +588,13 @@ std::vector<int> SimplePunter::GetOptionsRemainingAll() const {
     if (!can_option_)
       ret.push_back(0);
     else
-      ret.push_back(proto_.options_remaining(punter_id_));
+      ret.push_back(options_remaining_[punter_id_]);
   }
   return std::move(ret);
 }
 
 int SimplePunter::GetNumSplurgableEdges() const {
-  return proto_.pass_count() + 1;
+  return pass_count_ + 1;
 }
 
 GameMove SimplePunter::CreatePass() const {
@@ -306,26 +614,37 @@ GameMove SimplePunter::CreateOption(int source_index, int target_index) const {
 }
 
 int SimplePunter::GetScore(int punter_id) const {
-  return common::Scorer(proto_.mutable_scorer()).GetScore(punter_id);
+  return scorer_.GetScore(punter_id);
 }
 
 int SimplePunter::TryClaim(
     int punter_id, int site_index1, int site_index2) const {
-  return common::Scorer(proto_.mutable_scorer()).TryClaim(
-      punter_id, sites_->Get(site_index1).id(), sites_->Get(site_index2).id());
+  return scorer_.TryClaim(
+      punter_id, site_ids_[site_index1], site_ids_[site_index2]);
+}
+
+std::vector<int> SimplePunter::TryClaimAll(
+    int punter_id, const std::vector<int>& river_indexes) const {
+  std::vector<common::River> rivers;
+  rivers.reserve(river_indexes.size());
+  for (int river_index : river_indexes) {
+    const RiverState& river = rivers_->Get(river_index);
+    rivers.push_back({site_ids_[river.source()],
+                      site_ids_[river.target()]});
+  }
+  return scorer_.TryClaimAll(punter_id, rivers);
 }
 
 bool SimplePunter::IsConnected(
     int punter_id, int site_index1, int site_index2) const {
-  return common::Scorer(proto_.mutable_scorer()).IsConnected(
-      punter_id, sites_->Get(site_index1).id(), sites_->Get(site_index2).id());
+  return scorer_.IsConnected(
+      punter_id, site_ids_[site_index1], site_ids_[site_index2]);
 }
 
 std::vector<int> SimplePunter::GetConnectedMineList(
     int punter_id, int site_index) const {
-  std::vector<int> result =
-      common::Scorer(proto_.mutable_scorer()).GetConnectedMineList(
-          punter_id, sites_->Get(site_index).id());
+  std::vector<int> result = scorer_.GetConnectedMineList(
+      punter_id, site_ids_[site_index]);
   for (auto& site : result) {
     site = FindSiteIdxFromSiteId(site);
   }
@@ -334,9 +653,8 @@ std::vector<int> SimplePunter::GetConnectedMineList(
 
 std::vector<int> SimplePunter::GetConnectedSiteList(
     int punter_id, int site_index) const {
-  std::vector<int> result =
-      common::Scorer(proto_.mutable_scorer()).GetConnectedSiteList(
-          punter_id, sites_->Get(site_index).id());
+  std::vector<int> result = scorer_.GetConnectedSiteList(
+      punter_id, site_ids_[site_index]);
   for (auto& site : result) {
     site = FindSiteIdxFromSiteId(site);
   }
@@ -352,8 +670,8 @@ bool SimplePunter::IsConnectable(
     int site_index = q.front();
     q.pop();
     for (const auto& edge : edges_[site_index]) {
-      const RiverProto& river = rivers_->Get(edge.river);
-      if (river.has_punter() && river.punter() != -1 &&
+      const RiverState& river = rivers_->Get(edge.river);
+      if (river.punter() != -1 &&
           river.punter() != punter_id) {
         // This river is already used. Skip it.
         continue;
@@ -383,8 +701,8 @@ std::vector<int> SimplePunter::GetConnectableSiteTableFromSite(
     int site_index = q.front();
     q.pop();
     for (const auto& edge : edges_[site_index]) {
-      const RiverProto& river = rivers_->Get(edge.river);
-      if (river.has_punter() && river.punter() != -1 &&
+      const RiverState& river = rivers_->Get(edge.river);
+      if (river.punter() != -1 &&
           river.punter() != punter_id) {
         // This river is already used. Skip it.
         continue;
@@ -405,53 +723,59 @@ std::vector<int> SimplePunter::Simulate(const std::vector<GameMove>& moves)
   std::vector<GameMove> orig_move;
   for (auto m : moves) {
     // TODO: support splurge.
-    m.source = sites_->Get(m.source).id();
-    m.target = sites_->Get(m.target).id();
+    m.source = site_ids_[m.source];
+    m.target = site_ids_[m.target];
     orig_move.push_back(m);
   }
-  return common::Scorer(proto_.mutable_scorer()).Simulate(orig_move);
+  return scorer_.Simulate(orig_move);
 }
 
 int SimplePunter::dist_to_mine(int site, int mine) const {
-  int mine_site_id = sites_->Get(proto_.game_map().mines(mine).site()).id();
-  int site_id = sites_->Get(site).id();
-  return common::Scorer(proto_.mutable_scorer()).GetDistanceToMine(
-      mine_site_id, site_id);
+  int mine_site_id = site_ids_[mines_->Get(mine).site()];
+  int site_id = site_ids_[site];
+  return scorer_.GetDistanceToMine(mine_site_id, site_id);
+}
+
+int SimplePunter::FindRiver(int site_index1, int site_index2) const {
+  auto iter = river_index_map_.find(RiverKey(site_index1, site_index2));
+  return iter == river_index_map_.end() ? -1 : iter->second;
 }
 
 int SimplePunter::GetClaimingPunter(int site_index1, int site_index2) const {
-  for (const auto& edge : edges_[site_index1]) {
-    if (edge.site == site_index2) {
-      return rivers_->Get(edge.river).punter();
-    }
-  }
-  return -2;
+  int river_index = FindRiver(site_index1, site_index2);
+  if (river_index < 0)
+    return -2;
+  return rivers_->Get(river_index).punter();
 }
 
 int SimplePunter::GetOptioningPunter(int site_index1, int site_index2) const {
-  for (const auto& edge : edges_[site_index1]) {
-    if (edge.site == site_index2) {
-      return rivers_->Get(edge.river).option_punter();
-    }
-  }
-  return -2;
+  int river_index = FindRiver(site_index1, site_index2);
+  if (river_index < 0)
+    return -2;
+  return rivers_->Get(river_index).option_punter();
+}
+
+std::unique_ptr<GameStateProto> SimplePunter::CopyStateProto() const {
+  auto result = base::MakeUnique<GameStateProto>(proto_);
+  SaveStateToProto(result.get(), false /* compact */);
+  return result;
 }
 
 void SimplePunter::InternalGameMoveToExternal(GameMove* m) const {
   switch (m->type) {
     case GameMove::Type::CLAIM: {
-      m->source = sites_->Get(m->source).id();
-      m->target = sites_->Get(m->target).id();
+      m->source = site_ids_[m->source];
+      m->target = site_ids_[m->target];
       break;
     }
     case GameMove::Type::OPTION: {
-      m->source = sites_->Get(m->source).id();
-      m->target = sites_->Get(m->target).id();
+      m->source = site_ids_[m->source];
+      m->target = site_ids_[m->target];
       break;
     }
     case GameMove::Type::SPLURGE: {
       for (size_t i = 0; i < m->route.size(); ++i) {
-        m->route[i] = sites_->Get(m->route[i]).id();
+        m->route[i] = site_ids_[m->route[i]];
       }
       break;
     }
@@ -1,13 +1,78 @@
 #ifndef FRAMEWORK_SIMPLE_PUNTER_H_
 #define FRAMEWORK_SIMPLE_PUNTER_H_
 
+#include <stdint.h>
+
+#include <unordered_map>
+#include <vector>
+
 #include "base/macros.h"
+#include "common/scorer.h"
 #include "framework/game.h"
 #include "framework/game_proto.pb.h"
-#include "google/protobuf/repeated_field.h"
 
 namespace framework {
 
+// Live state of a river while the punter is running. The accessors mirror
+// RiverProto. Note that source and target are site indexes.
+class RiverState {
+ public:
+  RiverState() = default;
+  RiverState(int source, int target) : source_(source), target_(target) {}
+
+  int source() const { return source_; }
+  int target() const { return target_; }
+  int punter() const { return punter_; }
+  int option_punter() const { return option_punter_; }
+
+  void set_punter(int punter) { punter_ = punter; }
+  void set_option_punter(int option_punter) {
+    option_punter_ = option_punter;
+  }
+
+ private:
+  int source_ = -1;
+  int target_ = -1;
+  int punter_ = -1;
+  int option_punter_ = -1;
+};
+
+// Mirrors MineProto. Note that site is a site index.
+class MineState {
+ public:
+  MineState() = default;
+  explicit MineState(int site) : site_(site) {}
+
+  int site() const { return site_; }
+
+ private:
+  int site_ = -1;
+};
+
+// Contiguous array with the RepeatedPtrField API used by punters.
+template <typename T>
+class StateList {
+ public:
+  using iterator = typename std::vector<T>::iterator;
+  using const_iterator = typename std::vector<T>::const_iterator;
+
+  const T& Get(int index) const { return items_[index]; }
+  T* Mutable(int index) { return &items_[index]; }
+  int size() const { return static_cast<int>(items_.size()); }
+
+  iterator begin() { return items_.begin(); }
+  iterator end() { return items_.end(); }
+  const_iterator begin() const { return items_.begin(); }
+  const_iterator end() const { return items_.end(); }
+
+  void Clear() { items_.clear(); }
+  void Reserve(int size) { items_.reserve(size); }
+  void Add(const T& item) { items_.push_back(item); }
+
+ private:
+  std::vector<T> items_;
+};
+
 class SimplePunter : public Punter {
  public:
   SimplePunter();
@@ -26,22 +91,30 @@ class SimplePunter : public Punter {
   virtual void SetStateFromProto(std::unique_ptr<GameStateProto> state);
   std::unique_ptr<base::Value> GetState() override;
 
+  // Moves recorded with SetBestMove() use site indexes.
+  GameMove ToProtocolMove(const GameMove& move) const override;
+
+  // Predicts that each opponent claims the free river with the best score
+  // gain for it, and warms the distance maps and our owned subgraph.
+  std::vector<GameMove> PredictMoves(const GameMove& my_move) override;
+  void WarmUp() override;
+
   std::vector<Future> GetFutures() override final;
   void EnableSplurges() override final;
   void EnableOptions() override final;
 
+  struct Edge {
+    int site;  // site_index
+    int river;  // This Edge's index in rivers_.
+  };
+
   // API for sub classes.
-  int num_sites() const { return sites_->size(); }
+  int num_sites() const { return static_cast<int>(site_ids_.size()); }
   int dist_to_mine(int site, int mine) const;
 
-  int num_remaining_turns() const { return proto_.num_remaining_turns(); }
+  int num_remaining_turns() const { return num_remaining_turns_; }
 
  protected:
-  struct Edge {
-    int site;  // site_index
-    int river;  // This Edge's index in RiverProto.
-  };
-
   bool CanSplurge() const {
     return can_splurge_;
   }
@@ -60,9 +133,14 @@ class SimplePunter : public Punter {
   // Note that this method empties route.
   GameMove CreateSplurge(std::vector<int>* route_in_index) const;
   GameMove CreateOption(int source_index, int target_index) const;
+  // Claims the first free river, or passes. Sent if the turn overruns.
+  GameMove CreateFallbackMove() const;
 
   int GetScore(int punter_id) const;
   int TryClaim(int punter_id, int site_index1, int site_index2) const;
+  // Returns the score gain of claiming each river in |river_indexes|.
+  std::vector<int> TryClaimAll(
+      int punter_id, const std::vector<int>& river_indexes) const;
   bool IsConnected(int punter_id, int site_index1, int site_index2) const;
   std::vector<int> GetConnectedMineList(int punter_id, int site_index) const;
   std::vector<int> GetConnectedSiteList(int punter_id, int site_index) const;
@@ -72,6 +150,30 @@ class SimplePunter : public Punter {
                                                    int start_site) const;
   std::vector<int> Simulate(const std::vector<GameMove>& moves) const;
 
+  // Subgraph of the rivers claimed or optioned by |punter_id|, as
+  // site_idx -> {Edge}. Built on first use, then kept up to date as moves
+  // are applied. Loading a state drops it, so outside --persistent it is
+  // rebuilt once per turn.
+  const std::vector<std::vector<Edge>>& GetOwnedEdges(int punter_id) const;
+  // Marks in |visited| the sites reachable from |site_index| over the rivers
+  // claimed by |punter_id|, not counting options. Sites already marked are
+  // not walked through.
+  void VisitClaimedSites(int punter_id, int site_index,
+                         std::vector<bool>* visited) const;
+
+  // Called for each river taken while Run(moves) applies the moves, before
+  // Run() is called. A splurge calls OnRiverClaimed() or OnRiverOptioned()
+  // for each of its rivers, then OnSplurge() with all of them in order.
+  // The moves are applied right after the state is loaded, so a structure
+  // kept up to date here must also be dropped in SetState().
+  virtual void OnRiverClaimed(int punter_id, int river_index) {}
+  virtual void OnRiverOptioned(int punter_id, int river_index) {}
+  virtual void OnSplurge(int punter_id, const std::vector<int>& river_indexes) {}
+
+  // Returns the index in rivers_ of the river between site_index1 and
+  // site_index2, or -1 if they are not directly connected. O(1).
+  int FindRiver(int site_index1, int site_index2) const;
+
   // Returns: punter_id who claims the river between site_index1 and
   // site_index2, or -1 if not claimed, or -2 if not directly connected.
   int GetClaimingPunter(int site_index1, int site_index2) const;
@@ -79,33 +181,67 @@ class SimplePunter : public Punter {
 
   // Converts index-based GameMove into site id based GameMove.
   void InternalGameMoveToExternal(GameMove* m) const;
-  
+
+  // Returns a copy of the whole state, including the scorer.
+  std::unique_ptr<GameStateProto> CopyStateProto() const;
+
+  // Note that the scorer API takes site ids, not site indexes.
+  const common::Scorer& scorer() const { return scorer_; }
+
   int num_punters_ = -1;
   int punter_id_ = -1;
 
   std::vector<std::vector<Edge>> edges_; // site_idx -> {Edge}
+  // (min site_idx << 32 | max site_idx) -> river index. Built with edges_.
+  std::unordered_map<uint64_t, int> river_index_map_;
 
+  // Holds the state owned by sub classes (extensions and futures) only. The
+  // rest of the game state lives in flat members while running, and is
+  // written into GameStateProto only when the state is serialized.
   mutable GameStateProto proto_;
 
-  // Aliases to proto_.
-  google::protobuf::RepeatedPtrField<RiverProto>* rivers_;
-  google::protobuf::RepeatedPtrField<MineProto>* mines_;
+  // Aliases to river_list_ and mine_list_.
+  StateList<RiverState>* const rivers_ = &river_list_;
+  StateList<MineState>* const mines_ = &mine_list_;
 
   // river ids that were recently claimed / optioned
   std::vector<int> recent_updated_;
 
  private:
-  void SetAliasesToProto();
+  // Converts between the flat state and GameStateProto. The compact form
+  // leaves out the scorer, which is then recomputed on load.
+  void LoadStateFromProto(const GameStateProto& proto);
+  void SaveStateToProto(GameStateProto* proto, bool compact) const;
+  void LoadCompactState(const CompactStateProto& proto);
+  void SaveCompactState(CompactStateProto* proto) const;
+  void RecomputeScorer();
 
   int FindSiteIdxFromSiteId(int id) const;
 
   void GenerateAdjacencyList();
 
+  // Updates the river, the owned subgraph and recent_updated_, then calls
+  // the matching hook.
+  void ApplyClaim(int punter_id, int river_index);
+  void ApplyOption(int punter_id, int river_index);
+  void AddOwnedEdge(int punter_id, int river_index);
+
   bool can_splurge_ = false;
   bool can_option_ = false;
 
-  // Alias to proto_.
-  google::protobuf::RepeatedPtrField<SiteProto>* sites_;
+  int pass_count_ = 0;
+  int num_remaining_turns_ = 0;
+  std::vector<int> options_remaining_;  // punter_id -> options.
+  std::vector<Future> futures_;  // Ours, in site indexes.
+
+  std::vector<int> site_ids_;  // site_index -> site_id, sorted.
+  SiteIndexMap site_index_map_;  // site_id -> site_index.
+  StateList<RiverState> river_list_;
+  StateList<MineState> mine_list_;
+  // punter_id -> GetOwnedEdges(). Empty for punters not asked for yet.
+  mutable std::vector<std::vector<std::vector<Edge>>> owned_edges_;
+
+  common::Scorer scorer_;
 
   DISALLOW_COPY_AND_ASSIGN(SimplePunter);
 };
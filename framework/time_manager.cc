@@ -0,0 +1,91 @@
+#include "framework/time_manager.h"
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "framework/game_proto.pb.h"
+#include "gflags/gflags.h"
+
+DEFINE_int32(anytime_margin_ms, 100,
+             "The hard deadline of a search is this long before the end of "
+             "the turn (plus the measured overhead), to leave time for "
+             "sending the move.");
+
+namespace framework {
+
+namespace {
+
+// Weight of the latest turn in the moving averages.
+constexpr double kSmoothing = 0.3;
+
+// Fraction of the hard budget given to the soft budget, at the start and at
+// the end of the game. Searches are most expensive early, when most rivers
+// are free, so the early turns keep the largest safety margin.
+constexpr double kOpeningSoftFraction = 0.4;
+constexpr double kEndgameSoftFraction = 0.8;
+
+base::TimeDelta Scale(const base::TimeDelta& delta, double factor) {
+  return base::TimeDelta::FromMicroseconds(
+      static_cast<int64_t>(delta.InMicroseconds() * factor));
+}
+
+}  // namespace
+
+TimeManager::TimeManager() = default;
+TimeManager::~TimeManager() = default;
+
+void TimeManager::Load(const TimeManagerProto& proto) {
+  overhead_ = base::TimeDelta::FromMicroseconds(proto.overhead_us());
+  overshoot_ = proto.overshoot();
+}
+
+void TimeManager::Save(TimeManagerProto* proto) const {
+  proto->set_overhead_us(overhead_.InMicroseconds());
+  proto->set_overshoot(overshoot_);
+}
+
+void TimeManager::StartTurn(const base::TimeTicks& start_time,
+                            const base::TimeDelta& timeout) {
+  start_time_ = start_time;
+  end_time_ = start_time + timeout;
+  search_start_time_ = base::TimeTicks();
+  hard_deadline_ = end_time_ -
+      base::TimeDelta::FromMilliseconds(FLAGS_anytime_margin_ms) - overhead_;
+  soft_deadline_ = hard_deadline_;
+}
+
+void TimeManager::StartSearch(int remaining_turns, int total_turns) {
+  // E.g. a punter simulated inside another one.
+  if (start_time_.is_null())
+    return;
+  const base::TimeTicks now = base::TimeTicks::Now();
+  search_start_time_ = now;
+  base::TimeDelta overhead = now - start_time_;
+  overhead_ += Scale(overhead - overhead_, kSmoothing);
+  hard_deadline_ = end_time_ -
+      base::TimeDelta::FromMilliseconds(FLAGS_anytime_margin_ms) -
+      std::max(overhead, overhead_);
+
+  double progress = total_turns > 0 ?
+      1.0 - static_cast<double>(remaining_turns) / total_turns : 0.0;
+  progress = std::min(std::max(progress, 0.0), 1.0);
+  double fraction = kOpeningSoftFraction +
+      (kEndgameSoftFraction - kOpeningSoftFraction) * progress;
+  fraction /= 1.0 + overshoot_;
+  soft_deadline_ =
+      now + Scale(std::max(hard_deadline_ - now, base::TimeDelta()), fraction);
+}
+
+void TimeManager::EndSearch() {
+  if (search_start_time_.is_null())
+    return;
+  base::TimeDelta soft_budget = soft_deadline_ - search_start_time_;
+  if (soft_budget <= base::TimeDelta())
+    return;
+  base::TimeDelta over = base::TimeTicks::Now() - soft_deadline_;
+  double overshoot = std::max(0.0, over.InSecondsF() / soft_budget.InSecondsF());
+  overshoot_ += (overshoot - overshoot_) * kSmoothing;
+}
+
+}  // namespace framework
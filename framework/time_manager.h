@@ -0,0 +1,57 @@
+#ifndef FRAMEWORK_TIME_MANAGER_H_
+#define FRAMEWORK_TIME_MANAGER_H_
+
+#include "base/macros.h"
+#include "base/time/time.h"
+
+namespace framework {
+
+class TimeManagerProto;
+
+// Splits the time of a turn into a soft budget, after which a search should
+// not start new work, and a hard budget, by which it must return. The
+// budgets depend on the game phase and on what was measured in past turns:
+// the time spent outside the search (state load and save),
+// and how far searches ran past their soft budget.
+class TimeManager {
+ public:
+  TimeManager();
+  ~TimeManager();
+
+  void Load(const TimeManagerProto& proto);
+  void Save(TimeManagerProto* proto) const;
+
+  // Starts a turn that times out |timeout| after |start_time|. Until
+  // StartSearch() is called, both deadlines are the hard one.
+  void StartTurn(const base::TimeTicks& start_time,
+                 const base::TimeDelta& timeout);
+
+  // Called right before and after the search of the turn. |remaining_turns|
+  // and |total_turns| count this punter's own turns.
+  void StartSearch(int remaining_turns, int total_turns);
+  void EndSearch();
+
+  // Null if no turn is running.
+  base::TimeTicks soft_deadline() const { return soft_deadline_; }
+  base::TimeTicks hard_deadline() const { return hard_deadline_; }
+
+ private:
+  base::TimeTicks start_time_;
+  base::TimeTicks end_time_;
+  base::TimeTicks search_start_time_;
+  base::TimeTicks soft_deadline_;
+  base::TimeTicks hard_deadline_;
+
+  // Moving averages over past turns.
+  // Time from the start of the turn to the start of the search. The time
+  // after the search (state save and I/O) is assumed to be similar.
+  base::TimeDelta overhead_;
+  // Time the search ran past the soft deadline, relative to the soft budget.
+  double overshoot_ = 0;
+
+  DISALLOW_COPY_AND_ASSIGN(TimeManager);
+};
+
+}  // namespace framework
+
+#endif  // FRAMEWORK_TIME_MANAGER_H_
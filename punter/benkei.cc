@@ -31,16 +31,9 @@ bool Benkei::IsRiverClaimed(int river_ix) {
 }
 
 bool Benkei::IsRiverClaimed(int source, int dest) {
-  for(const auto &e: edges_[source]) {
-    int ix = e.river;
-    if((rivers_->Get(ix).source() == source && rivers_->Get(ix).target() == dest) ||
-       (rivers_->Get(ix).source() == dest && rivers_->Get(ix).target() == source)) {
-      return IsRiverClaimed(ix);
-    }
-  }
-  CHECK(false);
-  //NOTREACHED
-  return false;
+  int ix = FindRiver(source, dest);
+  CHECK_GE(ix, 0);
+  return IsRiverClaimed(ix);
 }
 
 void Benkei::SetUp(const common::SetUpData& args)
@@ -1,13 +1,15 @@
 #include "punter/friendly_punter.h"
 
+#include <algorithm>
 #include <vector>
 #include <random>
 #include <queue>
 
+#include "base/logging.h"
 #include "base/memory/ptr_util.h"
 #include "framework/game_proto.pb.h"
 
-using framework::RiverProto;
+using framework::RiverState;
 
 namespace punter {
 
@@ -62,33 +64,18 @@ framework::GameMove FriendlyPunter::Run() {
     }
   }
   
-  // Constract owned subgraph.
-  std::vector<std::vector<int>> adj(S, std::vector<int>());
-  for (auto& r : *rivers_) {
-    if (r.punter() != punter_id_)
-      continue;
-    adj[r.source()].push_back(r.target());
-    adj[r.target()].push_back(r.source());
-  }
-
-  // Constract adjacent list of reachabel (not-owned-by-others) edges.
-  std::vector<std::vector<int>> adj_available(S, std::vector<int>());
-  for (auto& r : *rivers_) {
-    if (!(r.punter() == punter_id_ || r.punter() == -1))
-      continue;
-    adj_available[r.source()].push_back(r.target());
-    adj_available[r.target()].push_back(r.source());
-  }
+  BuildAdjAvailable();
+  const std::vector<std::vector<int>>& adj_available = adj_available_;
 
   std::vector<std::vector<bool>> covered(M, std::vector<bool>(S, false));
   for (int i=0; i<M; i++)
-    dfs(mines_->Get(i).site(), adj, covered[i]);
+    VisitClaimedSites(punter_id_, mines_->Get(i).site(), &covered[i]);
   
   // Compute score from each mine.
   std::vector<int> mine_effect(M, 0);
   for (int i=0; i<M; i++) {
     std::vector<bool> visited(S, false);
-    dfs(mines_->Get(i).site(), adj, visited);
+    VisitClaimedSites(punter_id_, mines_->Get(i).site(), &visited);
     for (int j=0; j<S; j++) {
       if (visited[j]) {
         mine_effect[i] += value[j][i];
@@ -114,7 +101,7 @@ framework::GameMove FriendlyPunter::Run() {
   sort(vp.rbegin(), vp.rend());
 
   for (size_t i=0; i<vp.size(); i++) {
-    std::pair<int, int> result = FindForMine(vp[i].second, adj, adj_available, value, covered);
+    std::pair<int, int> result = FindForMine(vp[i].second, adj_available, value, covered);
     if (result.first >= 0)
       return CreateClaim(result.first, result.second);
   }
@@ -150,6 +137,7 @@ framework::GameMove FriendlyPunter::Run() {
 void FriendlyPunter::SetState(std::unique_ptr<base::Value> state_in) {
   auto state = base::DictionaryValue::From(std::move(state_in));
   SimplePunter::SetState(std::move(state));
+  adj_available_.clear();
 }
 
 std::unique_ptr<base::Value> FriendlyPunter::GetState() {
@@ -157,9 +145,35 @@ std::unique_ptr<base::Value> FriendlyPunter::GetState() {
   return state;
 }
 
+void FriendlyPunter::OnRiverClaimed(int punter_id, int river_index) {
+  if (adj_available_.empty() || punter_id == punter_id_)
+    return;
+  const RiverState& r = rivers_->Get(river_index);
+  auto erase = [](std::vector<int>* adj, int site_idx) {
+    auto it = std::find(adj->begin(), adj->end(), site_idx);
+    DCHECK(it != adj->end());
+    if (it != adj->end())
+      adj->erase(it);
+  };
+  erase(&adj_available_[r.source()], r.target());
+  erase(&adj_available_[r.target()], r.source());
+}
+
+void FriendlyPunter::BuildAdjAvailable() {
+  if (!adj_available_.empty())
+    return;
+  // Constract adjacent list of reachabel (not-owned-by-others) edges.
+  adj_available_.resize(edges_.size());
+  for (auto& r : *rivers_) {
+    if (!(r.punter() == punter_id_ || r.punter() == -1))
+      continue;
+    adj_available_[r.source()].push_back(r.target());
+    adj_available_[r.target()].push_back(r.source());
+  }
+}
+
 std::pair<int, int> FriendlyPunter::FindForMine(
     int mine_index,
-    const std::vector<std::vector<int>>& adj,
     const std::vector<std::vector<int>>& adj_available,
     const std::vector<std::vector<int>>& value,
     const std::vector<std::vector<bool>>& covered) {
@@ -169,12 +183,12 @@ std::pair<int, int> FriendlyPunter::FindForMine(
   // Compute covered nodes from any of mines.
   std::vector<bool> covered_by_any(S, false);
   for (int i=0; i<M; i++)
-    dfs(mines_->Get(i).site(), adj, covered_by_any);
+    VisitClaimedSites(punter_id_, mines_->Get(i).site(), &covered_by_any);
 
   // BFS from the least effective mine.
   std::vector<bool> visited(S, false);
   std::vector<int> distance(S, INF);
-  dfs(mines_->Get(mine_index).site(), adj, visited);
+  VisitClaimedSites(punter_id_, mines_->Get(mine_index).site(), &visited);
   std::vector<bool> covered_by_mine = visited;
   std::queue<std::pair<int, int>> q;
   for (int i=0; i<S; i++) if (visited[i]) {
@@ -267,18 +281,25 @@ std::pair<int, int> FriendlyPunter::FindForMine(
 }
 
 framework::GameMove FriendlyPunter::TryReplace() {
-  int best_score = -1;
-  int best_river_index = -1;
+  std::vector<int> candidates;
   for (int i = 0; i < rivers_->size(); i++) {
     if (rivers_->Get(i).punter() != punter_id_ && rivers_->Get(i).punter() != -1 &&
         rivers_->Get(i).option_punter() != punter_id_ && rivers_->Get(i).option_punter() != -1) {
       continue;
     }
-    
-    int score = TryClaim(punter_id_, rivers_->Get(i).source(), rivers_->Get(i).target());
+
+    candidates.push_back(i);
+  }
+  std::vector<int> gains = TryClaimAll(punter_id_, candidates);
+  int current_score = GetScore(punter_id_);
+
+  int best_score = -1;
+  int best_river_index = -1;
+  for (size_t i = 0; i < candidates.size(); i++) {
+    int score = current_score + gains[i];
     if (score > best_score) {
       best_score = score;
-      best_river_index = i;
+      best_river_index = candidates[i];
     }
   }
 
@@ -15,13 +15,24 @@ class FriendlyPunter : public framework::SimplePunter {
   void SetState(std::unique_ptr<base::Value> state) override;
   std::unique_ptr<base::Value> GetState() override;
 
+ protected:
+  // framework::SimplePunter:
+  void OnRiverClaimed(int punter_id, int river_index) override;
+
  private:
+  // Builds adj_available_ from the rivers if it is not built yet.
+  void BuildAdjAvailable();
+
   std::pair<int, int> FindForMine(int mine_index,
-      const std::vector<std::vector<int>>& adj,
       const std::vector<std::vector<int>>& adj_available,
       const std::vector<std::vector<int>>& value,
       const std::vector<std::vector<bool>>& covered);
   framework::GameMove TryReplace();
+
+  // Adjacency list of the rivers not owned by others, as site_idx -> site_idx.
+  // Built on first use after the state is set, then kept up to date by
+  // OnRiverClaimed().
+  std::vector<std::vector<int>> adj_available_;
 };
   
 
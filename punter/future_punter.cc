@@ -4,13 +4,12 @@
 #include <queue>
 
 #include "base/memory/ptr_util.h"
-#include "common/scorer.h"
 #include "framework/game_proto.pb.h"
 #include "framework/simple_punter.h"
 #include "gflags/gflags.h"
 
-using framework::MineProto;
-using framework::RiverProto;
+using framework::MineState;
+using framework::RiverState;
 using framework::FutureProto;
 
 DEFINE_bool(future_aggressive, false, "");
@@ -92,7 +91,7 @@ std::vector<framework::Future> FuturePunter::GetFuturesImpl() {
     }
     // Target must be a non-mine site.
     if (std::find_if(mines_->begin(), mines_->end(),
-                     [max_site_idx](const MineProto& mine) {
+                     [max_site_idx](const MineState& mine) {
                        return mine.site() == max_site_idx;
                      }) == mines_->end()) {
       candidates.emplace_back(FutureCandidate({max_score, min_dist, max_mine_idx, max_site_idx}));
@@ -117,7 +116,6 @@ std::vector<framework::Future> FuturePunter::GetFuturesImpl() {
 }
 
 framework::GameMove FuturePunter::Run() {
-  common::Scorer scorer(proto_.mutable_scorer());
   GenerateRiversToClaim();
 
   for (auto& f : proto_.futures()) {
@@ -152,7 +150,7 @@ framework::GameMove FuturePunter::RunMirac() {
 
   if (max_score == -1) {
     // We cannot gain more points, but claim edge to disturb other punters.
-    for (const RiverProto& river : *rivers_) {
+    for (const RiverState& river : *rivers_) {
       if (river.punter() == -1) {
           return {framework::GameMove::Type::CLAIM, punter_id_, river.source(), river.target()};
       }
@@ -25,15 +25,14 @@ void GameMapForAI::init(int num_punters, const framework::GameMap& game_map)
   themap_.resize(game_map.sites.size());
 
   for(size_t i = 0; i < game_map.sites.size(); ++i) {
-    int id = game_map.sites[i].id;
-    nodeinfo_[i].id = id;
-    id2ix[id] = i;
+    nodeinfo_[i].id = game_map.sites[i].id;
   }
+  id2ix = game_map.site_index_map;
 
   size_t ix = 0;
   for(const auto& e: game_map.rivers) {
-    node_index source = id2ix.at(e.source);
-    node_index dest = id2ix.at(e.target);
+    node_index source = id2ix.Get(e.source);
+    node_index dest = id2ix.Get(e.target);
     
     if(source > dest){ std::swap(source, dest); }
 
@@ -49,7 +48,7 @@ void GameMapForAI::init(int num_punters, const framework::GameMap& game_map)
 
   mines_.clear();
   for(const auto& m: game_map.mines) {
-    mines_.push_back(id2ix.at(m));
+    mines_.push_back(id2ix.Get(m));
   }
 
   for(auto &n: nodeinfo_) {
@@ -220,10 +219,11 @@ std::istream& GameMapForAI::deserialize(std::istream& is)
   int nodesize;
   is >> nodesize;
   nodeinfo_.resize(nodesize);
+  vector<int> ids(nodesize);
   for(int i = 0; i < nodesize; ++i) {
     auto& node = nodeinfo_[i];
     is >> node.id;
-    id2ix[node.id] = i;
+    ids[i] = node.id;
     node.minedist.resize(num_mines);
     node.reachable.resize(num_mines, vector<bool>(num_punters_, false));
     for(int j = 0; j < num_mines; ++j) {
@@ -238,6 +238,8 @@ std::istream& GameMapForAI::deserialize(std::istream& is)
     }
   }
 
+  id2ix.Build(ids);
+
   themap_.resize(nodesize);
 
   int edgesize;
@@ -3,7 +3,6 @@
 
 #include <vector>
 #include <iostream>
-#include <map>
 
 #include "framework/game.h"
 #include "base/optional.h"
@@ -61,7 +60,7 @@ class GameMapForAI
 
   void init(int num_punters, const framework::GameMap& game_map);
 
-  std::map<int, node_index> id2ix;
+  framework::SiteIndexMap id2ix;
   
  private:
   int num_punters_;
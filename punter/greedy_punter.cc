@@ -5,8 +5,8 @@
 #include "framework/game_proto.pb.h"
 #include "punter/greedy_punter.pb.h"
 
-using framework::MineProto;
-using framework::RiverProto;
+using framework::MineState;
+using framework::RiverState;
 
 namespace punter {
 
@@ -39,7 +39,7 @@ std::vector<framework::Future> GreedyPunter::GetFuturesImpl() {
   for (int i = greedy_ext->longest_path_size() - 1; i > 0; i--) {
     int target = greedy_ext->longest_path(i);
     if (std::find_if(mines_->begin(), mines_->end(),
-                     [target](const MineProto& mine) {
+                     [target](const MineState& mine) {
                        return mine.site() == target;
                      }) == mines_->end()) {
       futures.push_back({source, target});
@@ -99,7 +99,7 @@ void GreedyPunter::ComputeLongestPath() {
 framework::GameMove GreedyPunter::Run() {
   auto greedy_ext = proto_.MutableExtension(GreedyPunterProto::greedy_ext);
 
-  const RiverProto* river_with_max_score = nullptr;
+  const RiverState* river_with_max_score = nullptr;
   int max_score = -1;
   std::unique_ptr<std::set<std::pair<int, int>>> max_mines;  // {(mine_idx, site_id)}
   int longest_src = 0, longest_target = 0;
@@ -109,7 +109,7 @@ framework::GameMove GreedyPunter::Run() {
     longest_target = greedy_ext->longest_path(longest_path_index + 1);
   }
 
-  for (const RiverProto& r : *rivers_) {
+  for (const RiverState& r : *rivers_) {
     if (r.punter() != -1)
       continue;
 
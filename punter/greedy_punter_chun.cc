@@ -32,8 +32,8 @@ framework::GameMove GreedyPunterChun::Run(const std::vector<framework::GameMove>
       int target = move.target;
       DLOG(INFO) << "Src ix before conversion " << source;
       DLOG(INFO) << "Trg ix before conversion " << target;
-      gameutil::GameMapForAI::node_index srcix = themap.id2ix.at(source);
-      gameutil::GameMapForAI::node_index trgix = themap.id2ix.at(target);
+      gameutil::GameMapForAI::node_index srcix = themap.id2ix.Get(source);
+      gameutil::GameMapForAI::node_index trgix = themap.id2ix.Get(target);
       DLOG(INFO) << "Src ix after conversion " << srcix;
       DLOG(INFO) << "Trg ix after conversion " << trgix;
       int color = move.punter_id;
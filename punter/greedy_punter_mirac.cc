@@ -7,7 +7,7 @@
 #include "framework/simple_punter.h"
 #include "gflags/gflags.h"
 
-using framework::RiverProto;
+using framework::RiverState;
 
 DEFINE_bool(use_option, false, "");
 DEFINE_bool(refine_pos, false, "");
@@ -113,7 +113,7 @@ framework::GameMove GreedyPunterMirac::Run() {
 
   if (max_score == -1) {
     // We cannot gain more points, but claim edge to disturb other punters.
-    for (const RiverProto& river : *rivers_) {
+    for (const RiverState& river : *rivers_) {
       if (river.punter() == -1) {
           return {framework::GameMove::Type::CLAIM, punter_id_, river.source(), river.target()};
       }
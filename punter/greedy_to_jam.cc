@@ -38,8 +38,8 @@ framework::GameMove GreedyToJam::Run(const std::vector<framework::GameMove>& mov
     if(move.type == framework::GameMove::Type::CLAIM) {
       int source = move.source;
       int target = move.target;
-      gameutil::GameMapForAI::node_index srcix = themap.id2ix.at(source);
-      gameutil::GameMapForAI::node_index trgix = themap.id2ix.at(target);
+      gameutil::GameMapForAI::node_index srcix = themap.id2ix.Get(source);
+      gameutil::GameMapForAI::node_index trgix = themap.id2ix.Get(target);
       int color = move.punter_id;
       DLOG(INFO) << "Moves:" << source << " " << target << " " << color;
 
@@ -47,10 +47,10 @@ framework::GameMove GreedyToJam::Run(const std::vector<framework::GameMove>& mov
       DLOG(INFO) << "Plusscore" << plusscore;
     }else if(move.type == framework::GameMove::Type::SPLURGE) {
       int pid = move.route[0];
-      int p_ix = themap.id2ix.at(pid);
+      int p_ix = themap.id2ix.Get(pid);
       int color = move.punter_id;
       for(size_t ix = 1; ix < move.route.size(); ix++) {
-        int q_ix = themap.id2ix.at(move.route[ix]);
+        int q_ix = themap.id2ix.Get(move.route[ix]);
         themap.claim(p_ix, q_ix, color);
         p_ix = q_ix;
       }
@@ -1,7 +1,6 @@
 #include "punter/jammer.h"
 
 #include <vector>
-#include "common/scorer.h"
 
 namespace punter {
 
@@ -28,8 +27,6 @@ framework::GameMove Jammer::Run() {
 
   DLOG(INFO) << "Rival is " << rival;
 
-  common::Scorer scorer(proto_.mutable_scorer());
-
   Candidate attackmove = {};
   int attackdamage = 0;
   if (rival >= 0) {
@@ -41,7 +38,7 @@ framework::GameMove Jammer::Run() {
       DLOG(INFO) << "Rival 2nd best gain = " << rivalsecondbest.score;
       attackdamage = rivalbest.score - rivalsecondbest.score;
       attackmove = rivalbest;
-      attackdamage += scorer.TryClaim(punter_id_, rivalbest.source, rivalbest.target);
+      attackdamage += TryClaim(punter_id_, rivalbest.source, rivalbest.target);
     }
   }
   DLOG(INFO) << "Attack damage = " << attackdamage;
@@ -70,14 +67,19 @@ framework::GameMove Jammer::Run() {
 
 std::vector<Jammer::Candidate> Jammer::list_candidates(int punter_id)
 {
-  common::Scorer scorer(proto_.mutable_scorer());
+  std::vector<int> free_rivers;
+  for (int i = 0; i < rivers_->size(); ++i) {
+    if (rivers_->Get(i).punter() == -1)
+      free_rivers.push_back(i);
+  }
+  std::vector<int> gains = TryClaimAll(punter_id, free_rivers);
+  int score = GetScore(punter_id);
 
   std::vector<Candidate> deltas;
-  for (auto& river : *rivers_) {
-    if (river.punter() == -1) {
-      int sc = scorer.TryClaim(punter_id, river.source(), river.target());
-      deltas.emplace_back(Candidate({ sc, river.source(), river.target() }));
-    }
+  for (size_t i = 0; i < free_rivers.size(); ++i) {
+    const auto& river = rivers_->Get(free_rivers[i]);
+    int sc = score + gains[i];
+    deltas.emplace_back(Candidate({ sc, river.source(), river.target() }));
   }
   std::sort(deltas.begin(), deltas.end(),
             [](const Candidate& a, const Candidate& b) { return (a.score > b.score); });
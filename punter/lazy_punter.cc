@@ -6,7 +6,7 @@
 #include "base/memory/ptr_util.h"
 #include "framework/game_proto.pb.h"
 
-using framework::RiverProto;
+using framework::RiverState;
 
 namespace punter {
 
@@ -40,7 +40,7 @@ framework::GameMove LazyPunter::Run() {
   }
 
   double best_score = -1;
-  RiverProto best_river;
+  RiverState best_river;
   for (auto& r : *rivers_) {
     if (r.punter() != -1)
       continue;
@@ -1,14 +1,18 @@
 #include "punter/meta_punter.h"
 
+#include <algorithm>
+
 #include "base/files/file_util.h"
+#include "base/json/json_reader.h"
+#include "base/json/json_writer.h"
 #include "base/memory/ptr_util.h"
 #include "base/process/process_handle.h"
+#include "common/json_decoder.h"
 #include "common/protocol.h"
 #include "gflags/gflags.h"
 
 DEFINE_string(primary_worker_options, "", "Commandline for primary worker.");
 DEFINE_string(backup_worker_options, "", "Commandline for backup worker");
-DECLARE_bool(persistent);
 
 namespace punter {
 
@@ -28,6 +32,16 @@ void ExchangePingPong(common::Popen* subprocess) {
   common::WritePong(subprocess->stdin_write(), name.value());
 }
 
+// Decodes a reply of a worker, and copies its state to |state|.
+common::PunterMessage DecodeReply(const std::string& text,
+                                  std::string* state) {
+  common::PunterMessage reply;
+  CHECK(common::DecodePunterMessage(text, &reply)) << "Invalid reply";
+  CHECK(!reply.state.empty()) << "No state";
+  reply.state.CopyToString(state);
+  return reply;
+}
+
 std::string MakeShell(const std::string& options) {
   std::string executable =
       base::GetProcessExecutablePath(base::GetCurrentProcessHandle()).value();
@@ -49,29 +63,30 @@ void MetaPunter::OnInit() {
       true /* kill on parent death */);
   base::SetNonBlocking(fileno(primary_worker_->stdout_read()));
   base::SetNonBlocking(fileno(backup_worker_->stdout_read()));
+  waiter_ = base::MakeUnique<common::FdWaiter>();
+  waiter_->Add(fileno(primary_worker_->stdout_read()));
+  waiter_->Add(fileno(backup_worker_->stdout_read()));
   ExchangePingPong(primary_worker_.get());
   ExchangePingPong(backup_worker_.get());
 }
 
 void MetaPunter::SetUp(const common::SetUpData& args) {
-  auto request = common::SetUpData::ToJson(args);
-  common::WriteMessage(primary_worker_->stdin_write(), *request);
-  common::WriteMessage(backup_worker_->stdin_write(), *request);
+  request_.Clear();
+  common::SetUpData::WriteJson(args, &request_);
+  common::WriteMessage(primary_worker_->stdin_write(), request_.text());
+  common::WriteMessage(backup_worker_->stdin_write(), request_.text());
 
   // TODO timeout.
-  auto response1 = base::DictionaryValue::From(
-      common::ReadMessage(primary_worker_->stdout_read()));
-  auto response2 = base::DictionaryValue::From(
-      common::ReadMessage(backup_worker_->stdout_read()));
-
-  CHECK(response1->Remove("state", &primary_state_));
-  CHECK(response2->Remove("state", &backup_state_));
+  std::vector<base::Optional<std::string>> responses = ReadReplies(
+      {primary_worker_->stdout_read(), backup_worker_->stdout_read()},
+      base::TimeDelta(), base::TimeTicks());
+  CHECK(responses[0] && responses[1]);
+  common::PunterMessage response1 =
+      DecodeReply(responses[0].value(), &primary_state_);
+  DecodeReply(responses[1].value(), &backup_state_);
 
   // If futures is returned by primary, then use it.
-  base::ListValue* futures_value;
-  if (response1->GetList("futures", &futures_value)) {
-    futures_ = common::Futures::FromJson(*futures_value);
-  }
+  futures_ = std::move(response1.futures);
 
   timeout_ = kInitialTimeout;
 }
@@ -103,76 +118,159 @@ common::GameMove MetaPunter::Run(
   }
 
   // Run two workers in parallel.
-  {
-    base::DictionaryValue request;
-    timeout_history_.insert(
-        timeout_history_.end(), moves.begin(), moves.end());
-    request.Set("move.moves", common::GameMoves::ToJson(timeout_history_));
-    request.Set("state", primary_state_->CreateDeepCopy());
-    request.SetInteger("timeout_ms", timeout_.InMilliseconds());
-    common::WriteMessage(primary_worker_->stdin_write(), request);
-  }
-  {
-    base::DictionaryValue request;
-    request.Set("move.moves", common::GameMoves::ToJson(moves));
-    request.Set("state", backup_state_->CreateDeepCopy());
-    common::WriteMessage(backup_worker_->stdin_write(), request);
-  }
+  timeout_history_.insert(
+      timeout_history_.end(), moves.begin(), moves.end());
+  WriteMoveRequest(primary_worker_.get(), timeout_history_, primary_state_,
+                   timeout_.InMilliseconds());
+  WriteMoveRequest(backup_worker_.get(), moves, backup_state_, -1);
 
-  // Read backup worker first, which should be quickly done.
-  // TODO: fix me.
-  auto backup_response =
-      base::DictionaryValue::From(
-          common::ReadMessage(backup_worker_->stdout_read()));
-  CHECK(backup_response->Remove("state", &backup_state_));
-
-  auto primary_response =
-      base::DictionaryValue::From(common::ReadMessage(
-          primary_worker_->stdout_read(), timeout_, start));
+  // Wait for both until the primary times out. The backup should be
+  // quickly done, but has no time limit.
+  std::vector<base::Optional<std::string>> responses = ReadReplies(
+      {backup_worker_->stdout_read(), primary_worker_->stdout_read()},
+      timeout_, start);
+  if (!responses[0]) {
+    base::StringPiece text;
+    CHECK(common::ReadMessageText(backup_worker_->stdout_read(),
+                                  base::TimeDelta(), base::TimeTicks(),
+                                  &text));
+    responses[0] = text.as_string();
+  }
+  common::PunterMessage backup_response =
+      DecodeReply(responses[0].value(), &backup_state_);
+  CHECK(backup_response.type == common::PunterMessage::Type::MOVE);
 
-  if (!primary_response) {
+  if (!responses[1]) {
     // TIMEOUT.
-    return common::GameMove::FromJson(*backup_response);
+    return backup_response.move;
   }
 
-  CHECK(primary_response->Remove("state", &primary_state_));
+  common::PunterMessage primary_response =
+      DecodeReply(responses[1].value(), &primary_state_);
+  CHECK(primary_response.type == common::PunterMessage::Type::MOVE);
   timeout_history_.clear();
-  return common::GameMove::FromJson(*primary_response);
+  return primary_response.move;
+}
+
+void MetaPunter::WriteMoveRequest(common::Popen* worker,
+                                  const std::vector<common::GameMove>& moves,
+                                  base::StringPiece state,
+                                  int timeout_ms) {
+  request_.Clear();
+  request_.BeginObject();
+  request_.Key("move");
+  request_.BeginObject();
+  request_.Key("moves");
+  common::GameMoves::WriteJson(moves, &request_);
+  request_.EndObject();
+  request_.Key("state");
+  request_.Raw(state);
+  if (timeout_ms >= 0) {
+    request_.Key("timeout_ms");
+    request_.Int(timeout_ms);
+  }
+  request_.EndObject();
+  common::WriteMessage(worker->stdin_write(), request_.text());
+}
+
+std::vector<base::Optional<std::string>> MetaPunter::ReadReplies(
+    const std::vector<FILE*>& fps,
+    const base::TimeDelta& timeout,
+    const base::TimeTicks& start_time) {
+  std::vector<base::Optional<std::string>> replies(fps.size());
+  std::vector<size_t> pending(fps.size());
+  for (size_t i = 0; i < fps.size(); ++i)
+    pending[i] = i;
+
+  // A worker may exit right after its reply, so keep reading for the others.
+  while (true) {
+    std::vector<FILE*> pending_fps;
+    for (size_t i : pending)
+      pending_fps.push_back(fps[i]);
+    std::vector<int> closed_fds;
+    std::vector<base::Optional<std::string>> texts =
+        common::ReadMessageTexts(waiter_.get(), pending_fps, timeout,
+                                 start_time, &closed_fds);
+    for (int fd : closed_fds)
+      waiter_->Remove(fd);
+
+    std::vector<size_t> still_pending;
+    for (size_t j = 0; j < pending.size(); ++j) {
+      const size_t i = pending[j];
+      if (texts[j]) {
+        replies[i] = std::move(texts[j]);
+      } else if (std::find(closed_fds.begin(), closed_fds.end(),
+                           fileno(fps[i])) == closed_fds.end()) {
+        still_pending.push_back(i);
+      }
+    }
+    // Nothing closed means a timeout or a broken message.
+    if (closed_fds.empty() || still_pending.empty())
+      break;
+    pending.swap(still_pending);
+  }
+  return replies;
 }
 
 void MetaPunter::OnFinish() {
+  waiter_.reset();
   primary_worker_.reset();
   backup_worker_.reset();
 }
 
-void MetaPunter::SetState(std::unique_ptr<base::Value> state_in) {
+void MetaPunter::SetState(std::unique_ptr<base::Value> state) {
+  std::string json;
+  CHECK(base::JSONWriter::Write(*state, &json));
+  SetStateJson(json);
+}
+
+std::unique_ptr<base::Value> MetaPunter::GetState() {
+  common::JsonEncoder encoder;
+  WriteStateJson(&encoder);
+  return base::JSONReader::Read(encoder.text());
+}
+
+void MetaPunter::SetStateJson(base::StringPiece json) {
   // TODO merge map data.
-  auto state = base::DictionaryValue::From(std::move(state_in));
-  CHECK(state->Remove("primary", &primary_state_));
-  CHECK(state->Remove("backup", &backup_state_));
-  const base::ListValue* history_value;
-  CHECK(state->GetList("history", &history_value));
-  timeout_history_ = common::GameMoves::FromJson(*history_value);
-  int timeout_ms;
-  CHECK(state->GetInteger("timeout_ms", &timeout_ms));
+  common::JsonDecoder decoder(json);
+  base::StringPiece primary_state;
+  base::StringPiece backup_state;
+  bool has_history = false;
+  int timeout_ms = -1;
+  timeout_history_.clear();
+  CHECK(decoder.ReadObject([&](base::StringPiece key) {
+    if (key == "primary")
+      return decoder.SkipValue(&primary_state);
+    if (key == "backup")
+      return decoder.SkipValue(&backup_state);
+    if (key == "history") {
+      has_history = true;
+      return common::ReadGameMoves(&decoder, &timeout_history_);
+    }
+    if (key == "timeout_ms")
+      return decoder.ReadInt(&timeout_ms);
+    return decoder.SkipValue(nullptr);
+  })) << "Invalid state";
+  CHECK(!primary_state.empty());
+  CHECK(!backup_state.empty());
+  CHECK(has_history);
+  CHECK_GE(timeout_ms, 0);
+  primary_state.CopyToString(&primary_state_);
+  backup_state.CopyToString(&backup_state_);
   timeout_ = base::TimeDelta::FromMilliseconds(timeout_ms);
 }
 
-std::unique_ptr<base::Value> MetaPunter::GetState() {
-  auto state = base::MakeUnique<base::DictionaryValue>();
-  state->Set(
-      "primary",
-      FLAGS_persistent ?
-          primary_state_->CreateDeepCopy() :
-          std::move(primary_state_));
-  state->Set(
-      "backup",
-      FLAGS_persistent ?
-          backup_state_->CreateDeepCopy() :
-          std::move(backup_state_));
-  state->Set("history", common::GameMoves::ToJson(timeout_history_));
-  state->SetInteger("timeout_ms", timeout_.InMilliseconds());
-  return state;
+void MetaPunter::WriteStateJson(common::JsonEncoder* encoder) {
+  encoder->BeginObject();
+  encoder->Key("backup");
+  encoder->Raw(backup_state_);
+  encoder->Key("history");
+  common::GameMoves::WriteJson(timeout_history_, encoder);
+  encoder->Key("primary");
+  encoder->Raw(primary_state_);
+  encoder->Key("timeout_ms");
+  encoder->Int(timeout_.InMilliseconds());
+  encoder->EndObject();
 }
 
 }  // namespace punter
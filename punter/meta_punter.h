@@ -1,11 +1,18 @@
 #ifndef PUNTER_META_PUNTER_H_
 #define PUNTER_META_PUNTER_H_
 
+#include <stdio.h>
+
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "base/macros.h"
+#include "base/optional.h"
 #include "base/time/time.h"
 #include "base/values.h"
+#include "common/fd_waiter.h"
+#include "common/json_encoder.h"
 #include "common/popen.h"
 #include "framework/game.h"
 
@@ -23,16 +30,36 @@ class MetaPunter : public framework::Punter {
   void OnFinish() override;
   void SetState(std::unique_ptr<base::Value> state) override;
   std::unique_ptr<base::Value> GetState() override;
+  void SetStateJson(base::StringPiece json) override;
+  void WriteStateJson(common::JsonEncoder* encoder) override;
 
  private:
+  // Sends a move message to |worker|. A negative |timeout_ms| is left out.
+  void WriteMoveRequest(common::Popen* worker,
+                        const std::vector<common::GameMove>& moves,
+                        base::StringPiece state,
+                        int timeout_ms);
+
+  // Reads a reply from each of |fps| with common::ReadMessageTexts(), and
+  // stops watching the fds of the workers that have exited.
+  std::vector<base::Optional<std::string>> ReadReplies(
+      const std::vector<FILE*>& fps,
+      const base::TimeDelta& timeout,
+      const base::TimeTicks& start_time);
+
   // Tmp futures.
   std::vector<common::Future> futures_;
 
   std::unique_ptr<common::Popen> primary_worker_;
   std::unique_ptr<common::Popen> backup_worker_;
+  // Watches the stdout of both workers.
+  std::unique_ptr<common::FdWaiter> waiter_;
+  // Reused for every request to the workers.
+  common::JsonEncoder request_;
 
-  std::unique_ptr<base::Value> primary_state_;
-  std::unique_ptr<base::Value> backup_state_;
+  // The workers' states, as JSON text. Relayed without parsing.
+  std::string primary_state_;
+  std::string backup_state_;
 
   base::TimeDelta timeout_;
   std::vector<common::GameMove> timeout_history_;
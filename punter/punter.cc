@@ -33,6 +33,6 @@ int main(int argc, char* argv[]) {
   SetBlocking(2);
 
   std::unique_ptr<Punter> punter = PunterByName(FLAGS_punter);
-  Game game(std::move(punter));
+  Game game(std::move(punter), []() { return PunterByName(FLAGS_punter); });
   game.Run();
 }
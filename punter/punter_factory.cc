@@ -2,6 +2,7 @@
 
 #include "base/logging.h"
 #include "base/memory/ptr_util.h"
+#include "common/json_decoder.h"
 #include "punter/benkei.h"
 #include "punter/extension_example_punter.h"
 #include "punter/friendly_punter.h"
@@ -85,19 +86,58 @@ framework::GameMove SwitchingPunter::Run(
   return core_->Run(moves);
 }
 
+// The state is {"core": name, "state": the core's state}, so that the
+// core's state is relayed as is. The older shape, the core's state with
+// "core" added to it, is still accepted; the core is given all of it.
 void SwitchingPunter::SetState(std::unique_ptr<base::Value> state_in) {
   auto state = base::DictionaryValue::From(std::move(state_in));
   CHECK(state->GetString("core", &name_));
+  std::unique_ptr<base::Value> core_state;
+  if (!state->Remove("state", &core_state))
+    core_state = std::move(state);
   core_ = PunterByName(name_);
-  core_->SetState(std::move(state));
+  core_->SetState(std::move(core_state));
 }
 
 std::unique_ptr<base::Value> SwitchingPunter::GetState() {
-  auto value = base::DictionaryValue::From(core_->GetState());
+  auto value = base::MakeUnique<base::DictionaryValue>();
   value->SetString("core", name_);
+  value->Set("state", core_->GetState());
   return value;
 }
 
+void SwitchingPunter::SetStateJson(base::StringPiece json) {
+  common::JsonDecoder decoder(json);
+  base::StringPiece core_state;
+  name_.clear();
+  CHECK(decoder.ReadObject([this, &decoder, &core_state](
+      base::StringPiece key) {
+    if (key == "core") {
+      std::string buffer;
+      base::StringPiece name;
+      if (!decoder.ReadString(&name, &buffer))
+        return false;
+      name.CopyToString(&name_);
+      return true;
+    }
+    if (key == "state")
+      return decoder.SkipValue(&core_state);
+    return decoder.SkipValue(nullptr);
+  })) << "Invalid state";
+  CHECK(!name_.empty());
+  core_ = PunterByName(name_);
+  core_->SetStateJson(core_state.empty() ? json : core_state);
+}
+
+void SwitchingPunter::WriteStateJson(common::JsonEncoder* encoder) {
+  encoder->BeginObject();
+  encoder->Key("core");
+  encoder->String(name_);
+  encoder->Key("state");
+  core_->WriteStateJson(encoder);
+  encoder->EndObject();
+}
+
 // static
 std::string SwitchingPunter::BenkeiOrJam(const common::SetUpData& args) {
   if (args.num_punters == 2 &&
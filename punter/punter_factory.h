@@ -21,6 +21,8 @@ public:
   framework::GameMove Run(const std::vector<framework::GameMove>& moves) override;
   void SetState(std::unique_ptr<base::Value> state) override;
   std::unique_ptr<base::Value> GetState() override;
+  void SetStateJson(base::StringPiece json) override;
+  void WriteStateJson(common::JsonEncoder* encoder) override;
 
   static std::string BenkeiOrJam(const common::SetUpData& args);
   static std::string MiracOrJamOrFriendly(const common::SetUpData& args);
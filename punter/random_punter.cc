@@ -4,7 +4,7 @@
 #include "framework/game_proto.pb.h"
 #include "google/protobuf/repeated_field.h"
 
-using framework::RiverProto;
+using framework::RiverState;
 
 namespace punter {
 
@@ -14,7 +14,7 @@ RandomPunter::RandomPunter()
 RandomPunter::~RandomPunter() = default;
 
 framework::GameMove RandomPunter::Run() {
-  std::vector<RiverProto> candidates;
+  std::vector<RiverState> candidates;
   for (auto& r : *rivers_) {
     if (r.punter() == -1) {
       candidates.push_back(r);
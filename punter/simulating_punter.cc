@@ -34,7 +34,7 @@ public:
 
   std::unique_ptr<Shadow> Clone() const {
     auto res = base::MakeUnique<Shadow>();
-    res->Init(proto_);
+    res->Init(*CopyStateProto());
     return res;
   }
   void Advance(const GameMove& next) {
@@ -125,7 +125,7 @@ void UniqifyByMove(std::vector<Snapshot>* snapshot) {
   snapshot->swap(new_snapshots);
 }
 
-GameMove ClaimRiver(int id, const framework::RiverProto& r) {
+GameMove ClaimRiver(int id, const framework::RiverState& r) {
   int source = std::min(r.source(), r.target());
   int target = r.source() + r.target() - source;
   return GameMove::Claim(id, source, target);
@@ -143,7 +143,7 @@ void SimulatingPunter::SetUp(const common::SetUpData& args) {
 framework::GameMove SimulatingPunter::Run() {
   const int kMaxStep = 3;
   std::vector<Snapshot> old_snapshot{GenerateSnapshot({})};
-  for (int step = 0; step < kMaxStep; ++step) {
+  auto search = [this, &old_snapshot](int step) {
     VLOG(1) << "step:" << step << " Score:" << old_snapshot.front().total_score << "-" << old_snapshot.back().total_score << " (top:" << SnapshotScoreStr(old_snapshot.front()) << ") count: " << old_snapshot.size();
     std::vector<Snapshot> new_snapshots;
     for (const auto& state : old_snapshot) {
@@ -151,12 +151,18 @@ framework::GameMove SimulatingPunter::Run() {
     }
     if (new_snapshots.size() == 0) {
       // Game end.
-      break;
+      return false;
     }
+    // A partial first step still ranks the first moves it has seen, but a
+    // partial deeper step would be biased, so keep the previous answer.
+    if (ShouldStop() && step > 1)
+      return false;
     ShrinkToTop(&new_snapshots);
     old_snapshot.swap(new_snapshots);
-  }
-  return old_snapshot[0].moves[0];
+    SetBestMove(old_snapshot[0].moves[0]);
+    return true;
+  };
+  return RunIterativeDeepening(kMaxStep, search, CreateFallbackMove());
 }
 
 Snapshot SimulatingPunter::GenerateSnapshot(
@@ -176,6 +182,8 @@ void SimulatingPunter::GenerateNextSnapshots(
   for (const auto& r : *rivers_) {
     if (r.punter() >= 0)
       continue;
+    if (ShouldStop())
+      return;
     std::unique_ptr<Shadow> punter = punter0->Clone();
     std::vector<GameMove> new_moves{ClaimRiver(punter_id_, r)};
     punter->Advance(new_moves[0]);
@@ -207,7 +215,7 @@ void SimulatingPunter::ShrinkToTop(std::vector<Snapshot>* snapshots) {
 
 std::unique_ptr<Shadow> SimulatingPunter::SummonShadow() const {
   auto shadow =  base::MakeUnique<Shadow>();
-  shadow->Init(proto_);
+  shadow->Init(*CopyStateProto());
   return shadow;
 }
 
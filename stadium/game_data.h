@@ -13,6 +13,7 @@ namespace stadium {
 using Site = common::Site;
 using River = common::River;
 using Map = common::GameMap;
+using SiteIndexMap = common::SiteIndexMap;
 using Move = common::GameMove;
 
 Map ReadMapFromFileOrDie(const std::string& path);
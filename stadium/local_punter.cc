@@ -10,11 +10,10 @@
 
 #include "base/files/scoped_file.h"
 #include "base/files/file_util.h"
-#include "base/json/json_reader.h"
-#include "base/json/json_writer.h"
 #include "base/memory/ptr_util.h"
 #include "base/strings/string_number_conversions.h"
 #include "base/time/time.h"
+#include "common/json_decoder.h"
 #include "common/protocol.h"
 
 DEFINE_bool(persistent, false, "Do not kill child process for each turn.");
@@ -38,99 +37,110 @@ LocalPunter::~LocalPunter() = default;
 PunterInfo LocalPunter::SetUp(const common::SetUpData& args) {
   punter_id_ = args.punter_id;
 
-  auto request = common::SetUpData::ToJson(args);
+  request_.Clear();
+  common::SetUpData::WriteJson(args, &request_);
 
   std::string name;
-  std::unique_ptr<base::DictionaryValue> response;
+  base::Optional<std::string> response;
   if (FLAGS_persistent) {
-    response = base::DictionaryValue::From(
-        RunProcess(subprocess_.get(), *request, &name, base::TimeDelta::FromSeconds(10)));
+    response = RunProcess(subprocess_.get(), request_.text(), &name,
+                          base::TimeDelta::FromSeconds(10));
   } else {
     common::Popen subprocess(shell_);
     InitializeSubprocess(&subprocess);
 
-    response = base::DictionaryValue::From(
-        RunProcess(&subprocess, *request, &name, base::TimeDelta::FromSeconds(10)));
+    response = RunProcess(&subprocess, request_.text(), &name,
+                          base::TimeDelta::FromSeconds(10));
   }
   CHECK(response) << "Setup() failed for punter " << punter_id_;
-  CHECK(response->Remove("state", &state_));
+  common::PunterMessage reply;
+  CHECK(common::DecodePunterMessage(response.value(), &reply));
+  CHECK(reply.type == common::PunterMessage::Type::READY);
+  CHECK(!reply.state.empty());
+  reply.state.CopyToString(&state_);
 
   std::vector<River> futures;
   if (args.settings.futures) {
-    const base::ListValue* futures_list;
-    CHECK(response->GetList("futures", &futures_list));
-    for (int i = 0; i < futures_list->GetSize(); ++i) {
-      const base::DictionaryValue* future_value;
-      CHECK(futures_list->GetDictionary(i, &future_value));
-      int source, target;
-      CHECK(future_value->GetInteger("source", &source));
-      CHECK(future_value->GetInteger("target", &target));
-      futures.push_back(River{source, target});
-      // TDOO check if source is mine.
-    }
+    // TDOO check if source is mine.
+    futures = std::move(reply.futures);
   }
   return {name, futures};
 }
 
 base::Optional<Move> LocalPunter::OnTurn(const std::vector<Move>& moves) {
-  auto request = base::MakeUnique<base::DictionaryValue>();
-  {
-    auto action_dict = base::MakeUnique<base::DictionaryValue>();
-    action_dict->Set("moves", common::GameMoves::ToJson(moves));
-    request->Set("move", std::move(action_dict));
-    request->Set("state", state_->CreateDeepCopy());
-  }
+  request_.Clear();
+  request_.BeginObject();
+  request_.Key("move");
+  request_.BeginObject();
+  request_.Key("moves");
+  common::GameMoves::WriteJson(moves, &request_);
+  request_.EndObject();
+  request_.Key("state");
+  request_.Raw(state_);
+  request_.EndObject();
 
   // TODO: Implement timeout.
-  std::unique_ptr<base::DictionaryValue> response;
+  base::Optional<std::string> response;
   if (FLAGS_persistent) {
-    response = base::DictionaryValue::From(
-        RunProcess(subprocess_.get(), *request, nullptr, base::TimeDelta::FromSeconds(1)));
+    response = RunProcess(subprocess_.get(), request_.text(), nullptr,
+                          base::TimeDelta::FromSeconds(1));
   } else {
     common::Popen subprocess(shell_);
     InitializeSubprocess(&subprocess);
 
-    response = base::DictionaryValue::From(
-        RunProcess(&subprocess, *request, nullptr, base::TimeDelta::FromSeconds(1)));
+    response = RunProcess(&subprocess, request_.text(), nullptr,
+                          base::TimeDelta::FromSeconds(1));
   }
   if (!response) {
     LOG(INFO) << "LOG: P" << punter_id_ << " timeout";
     return base::nullopt;
   }
 
-  CHECK(response->Remove("state", &state_));
-  return Move::FromJson(*response);
+  common::PunterMessage reply;
+  CHECK(common::DecodePunterMessage(response.value(), &reply));
+  CHECK(reply.type == common::PunterMessage::Type::MOVE);
+  CHECK(!reply.state.empty());
+  reply.state.CopyToString(&state_);
+  return reply.move;
 }
 
 void LocalPunter::OnStop(const std::vector<Move>& moves,
                          const std::vector<int>& scores) {
-  auto request = base::MakeUnique<base::DictionaryValue>();
-  request->Set("stop.moves", common::GameMoves::ToJson(moves));
-  {
-    auto scores_value = base::MakeUnique<base::ListValue>();
-    for (int punter_id = 0; punter_id < scores.size(); ++punter_id) {
-      auto score = base::MakeUnique<base::DictionaryValue>();
-      score->SetInteger("punter", punter_id);
-      score->SetInteger("score", scores[punter_id]);
-      scores_value->Append(std::move(score));
-    }
-    request->Set("stop.scores", std::move(scores_value));
+  request_.Clear();
+  request_.BeginObject();
+  request_.Key("state");
+  request_.Raw(state_);
+  request_.Key("stop");
+  request_.BeginObject();
+  request_.Key("moves");
+  common::GameMoves::WriteJson(moves, &request_);
+  request_.Key("scores");
+  request_.BeginArray();
+  for (int punter_id = 0; punter_id < scores.size(); ++punter_id) {
+    request_.BeginObject();
+    request_.Key("punter");
+    request_.Int(punter_id);
+    request_.Key("score");
+    request_.Int(scores[punter_id]);
+    request_.EndObject();
   }
-  request->Set("state", state_->CreateDeepCopy());
+  request_.EndArray();
+  request_.EndObject();
+  request_.EndObject();
 
   if (FLAGS_persistent) {
-    RunProcess(subprocess_.get(), *request, nullptr, base::TimeDelta(),
+    RunProcess(subprocess_.get(), request_.text(), nullptr, base::TimeDelta(),
                false);
   } else {
     common::Popen subprocess(shell_);
     InitializeSubprocess(&subprocess);
-    RunProcess(&subprocess, *request, nullptr, base::TimeDelta(), false);
+    RunProcess(&subprocess, request_.text(), nullptr, base::TimeDelta(), false);
   }
 }
 
-std::unique_ptr<base::Value> LocalPunter::RunProcess(
+base::Optional<std::string> LocalPunter::RunProcess(
     common::Popen* subprocess,
-    const base::Value& request,
+    base::StringPiece request,
     std::string* out_name,
     const base::TimeDelta& timeout,
     bool expect_reply) {
@@ -149,10 +159,15 @@ std::unique_ptr<base::Value> LocalPunter::RunProcess(
   // Exchange the message.
   common::WriteMessage(subprocess->stdin_write(), request);
   if (!expect_reply)
-    return nullptr;
+    return base::nullopt;
 
-  std::unique_ptr<base::Value> result =
-      common::ReadMessage(subprocess->stdout_read(), timeout, start_time);
+  base::Optional<std::string> result;
+  base::StringPiece text;
+  // Copy the text; the read buffer goes with |subprocess|.
+  if (common::ReadMessageText(subprocess->stdout_read(), timeout, start_time,
+                              &text)) {
+    result = text.as_string();
+  }
 
   VLOG(3) << "Finished in " << (base::TimeTicks::Now() - start_time).InMilliseconds() << " ms";
   return result;
@@ -5,8 +5,9 @@
 #include <string>
 
 #include "base/macros.h"
-#include "base/values.h"
+#include "base/optional.h"
 #include "base/time/time.h"
+#include "common/json_encoder.h"
 #include "common/popen.h"
 #include "stadium/punter.h"
 
@@ -23,9 +24,11 @@ class LocalPunter : public Punter {
               const std::vector<int>& scores) override;
 
  private:
-  std::unique_ptr<base::Value> RunProcess(
+  // Returns the text of the reply, or null on timeout or if
+  // |expect_reply| is false.
+  base::Optional<std::string> RunProcess(
       common::Popen* subprocess,
-      const base::Value& request,
+      base::StringPiece request,
       std::string* out_name,
       const base::TimeDelta& timeout,
       bool expect_reply=true);
@@ -33,8 +36,11 @@ class LocalPunter : public Punter {
   const std::string shell_;
 
   int punter_id_;
-  std::unique_ptr<base::Value> state_;
+  // The punter's state, as JSON text. Relayed without parsing.
+  std::string state_;
   std::unique_ptr<common::Popen> subprocess_;
+  // Reused for every request.
+  common::JsonEncoder request_;
 
   DISALLOW_COPY_AND_ASSIGN(LocalPunter);
 };
@@ -9,10 +9,8 @@
 #include <vector>
 
 #include "base/files/file_util.h"
-#include "base/json/json_writer.h"
 #include "base/logging.h"
-#include "base/memory/ptr_util.h"
-#include "base/values.h"
+#include "common/json_encoder.h"
 #include "common/scorer.h"
 #include "gflags/gflags.h"
 
@@ -33,61 +31,16 @@ std::string PrintVectorInt(const std::vector<int>& v) {
 void WriteResults(const std::string& path,
                   const std::vector<int>& scores,
                   const std::vector<Move>& moves) {
-  auto json = base::MakeUnique<base::DictionaryValue>();
-
-  auto scores_value = base::MakeUnique<base::ListValue>();
-  scores_value->Reserve(scores.size());
-  for (int score : scores) {
-    scores_value->AppendInteger(score);
-  }
-  json->Set("scores", std::move(scores_value));
-
-  auto moves_value = base::MakeUnique<base::ListValue>();
-  moves_value->Reserve(moves.size());
-  for (const auto& move : moves) {
-    auto move_value = base::MakeUnique<base::DictionaryValue>();
-    switch (move.type) {
-      case Move::Type::CLAIM: {
-        auto claim_value = base::MakeUnique<base::DictionaryValue>();
-        claim_value->SetInteger("punter", move.punter_id);
-        claim_value->SetInteger("source", move.source);
-        claim_value->SetInteger("target", move.target);
-        move_value->Set("claim", std::move(claim_value));
-        break;
-      }
-      case Move::Type::PASS: {
-        auto pass_value = base::MakeUnique<base::DictionaryValue>();
-        pass_value->SetInteger("punter", move.punter_id);
-        move_value->Set("pass", std::move(pass_value));
-        break;
-      }
-      case Move::Type::SPLURGE: {
-        auto splurge_value = base::MakeUnique<base::DictionaryValue>();
-        splurge_value->SetInteger("punter", move.punter_id);
-        auto route_value = base::MakeUnique<base::ListValue>();
-        route_value->Reserve(move.route.size());
-        for (const auto& site : move.route)
-          route_value->Append(base::MakeUnique<base::Value>(site));
-        splurge_value->Set("route", std::move(route_value));
-        move_value->Set("splurge", std::move(splurge_value));
-        break;
-      }
-      case Move::Type::OPTION: {
-        auto option_value = base::MakeUnique<base::DictionaryValue>();
-        option_value->SetInteger("punter", move.punter_id);
-        option_value->SetInteger("source", move.source);
-        option_value->SetInteger("target", move.target);
-        move_value->Set("option", std::move(option_value));
-        break;
-      }
-    }
-    moves_value->Append(std::move(move_value));
-  }
-  json->Set("moves", std::move(moves_value));
-
-  std::string output;
-  CHECK(base::JSONWriter::Write(*json, &output));
-  base::WriteFile(base::FilePath(path), output.data(), output.size());
+  common::JsonEncoder output;
+  output.BeginObject();
+  output.Key("moves");
+  common::GameMoves::WriteJson(moves, &output);
+  output.Key("scores");
+  output.IntList(scores);
+  output.EndObject();
+
+  const std::string& text = output.text();
+  base::WriteFile(base::FilePath(path), text.data(), text.size());
 }
 
 }
@@ -125,21 +78,35 @@ struct Referee::RiverState {
 // static
 Referee::MapState Referee::MapState::FromMap(const Map& map) {
   MapState map_state;
-  for (const Site& site : map.sites) {
-    auto result = map_state.sites.insert(
-        std::make_pair(site.id, SiteState{site.id}));
-    CHECK(result.second) << "Duplicated site: " << site.id;
-  }
+  // Duplicated sites are rejected when |map| is parsed.
+  map_state.site_index_map = map.site_index_map;
+  map_state.sites.reserve(map.sites.size());
+  for (const Site& site : map.sites)
+    map_state.sites.push_back(SiteState{site.id});
   for (const River& river : map.rivers) {
+    int source = map.GetSiteIndex(river.source);
+    int target = map.GetSiteIndex(river.target);
     auto result = map_state.rivers.insert(
-        std::make_pair(RiverKey(river.source, river.target),
-                       RiverState(river.source, river.target)));
+        std::make_pair(RiverKey(source, target),
+                       RiverState(source, target)));
     CHECK(result.second) << "Duplicated river: "
                          << river.source << "-" << river.target;
   }
   return map_state;
 }
 
+Referee::RiverState* Referee::MapState::FindRiver(
+    int site_id1, int site_id2) {
+  int site_index1 = site_index_map.Find(site_id1);
+  int site_index2 = site_index_map.Find(site_id2);
+  if (site_index1 < 0 || site_index2 < 0)
+    return nullptr;
+  auto iter = rivers.find(RiverKey(site_index1, site_index2));
+  if (iter == rivers.end())
+    return nullptr;
+  return &iter->second;
+}
+
 Referee::Referee() = default;
 Referee::~Referee() = default;
 
@@ -154,17 +121,16 @@ void Referee::Setup(const std::vector<PunterInfo>& punter_info_list,
   options_remaining_.resize(punter_info_list.size(), map->mines.size());
 
   map_state_ = MapState::FromMap(*map);
-  common::Scorer scorer(&scorer_);
-  scorer.Initialize(punter_info_list.size(), *map);
+  scorer_.Initialize(punter_info_list.size(), *map);
   for (size_t punter_id = 0; punter_id < punter_info_list.size();
        ++punter_id) {
-    scorer.AddFuture(punter_id, punter_info_list[punter_id].futures);
+    scorer_.AddFuture(punter_id, punter_info_list[punter_id].futures);
   }
 }
 
 bool Referee::ValidateClaim(const Move& move, int turn_id, int punter_id) {
-  auto iter = map_state_.rivers.find(RiverKey(move.source, move.target));
-  if (iter == map_state_.rivers.end()) {
+  RiverState* river_ptr = map_state_.FindRiver(move.source, move.target);
+  if (!river_ptr) {
     LOG(ERROR) << "BUG: [" << turn_id << "] P" << punter_id
                << ": Punter \"" << punter_info_list_[punter_id].name << "\" "
                << "tried to claim a non-existence river "
@@ -173,7 +139,7 @@ bool Referee::ValidateClaim(const Move& move, int turn_id, int punter_id) {
     return false;
   }
 
-  RiverState& river = iter->second;
+  RiverState& river = *river_ptr;
   if (river.punter_id >= 0) {
     LOG(ERROR) << "BUG: [" << turn_id << "] P" << punter_id
                << ": Punter \"" << punter_info_list_[punter_id].name
@@ -213,8 +179,8 @@ bool Referee::ValidateSplurge(const Move& move, int turn_id, int punter_id) {
   for (int i = 0; i + 1 < move.route.size(); ++i) {
     int s = move.route[i];
     int t = move.route[i + 1];
-    auto iter = map_state_.rivers.find(RiverKey(s, t));
-    if (iter == map_state_.rivers.end()) {
+    const RiverState* river_ptr = map_state_.FindRiver(s, t);
+    if (!river_ptr) {
       LOG(ERROR) << "BUG: [" << turn_id << "] P" << punter_id
                  << ": Punter \"" << punter_info_list_[punter_id].name << "\" "
                  << "tried to splurge over a non-existence river "
@@ -223,7 +189,7 @@ bool Referee::ValidateSplurge(const Move& move, int turn_id, int punter_id) {
       return false;
     }
 
-    const RiverState& river = iter->second;
+    const RiverState& river = *river_ptr;
     if (river.punter_id >= 0) {
       if (river.option_punter_id >= 0) {
         LOG(ERROR) << "BUG: [" << turn_id << "] P" << punter_id
@@ -250,8 +216,7 @@ bool Referee::ValidateSplurge(const Move& move, int turn_id, int punter_id) {
   for (int i = 0; i + 1 < move.route.size(); ++i) {
     int s = move.route[i];
     int t = move.route[i + 1];
-    auto iter = map_state_.rivers.find(RiverKey(s, t));
-    RiverState& river = iter->second;
+    RiverState& river = *map_state_.FindRiver(s, t);
     if (river.punter_id == -1) {
       river.punter_id = punter_id;
     } else {
@@ -272,8 +237,8 @@ bool Referee::ValidateOption(const Move& move, int turn_id, int punter_id) {
     return false;
   }
 
-  auto iter = map_state_.rivers.find(RiverKey(move.source, move.target));
-  if (iter == map_state_.rivers.end()) {
+  RiverState* river_ptr = map_state_.FindRiver(move.source, move.target);
+  if (!river_ptr) {
     LOG(ERROR) << "BUG: [" << turn_id << "] P" << punter_id
                << ": Punter \"" << punter_info_list_[punter_id].name << "\" "
                << "tried to option a non-existence river "
@@ -282,7 +247,7 @@ bool Referee::ValidateOption(const Move& move, int turn_id, int punter_id) {
     return false;
   }
 
-  RiverState& river = iter->second;
+  RiverState& river = *river_ptr;
   if (river.punter_id == -1) {
     LOG(ERROR) << "BUG: [" << turn_id << "] P" << punter_id
                << ": Punter \"" << punter_info_list_[punter_id].name
@@ -343,17 +308,17 @@ Move Referee::HandleMove(int turn_id, int punter_id, const Move& move) {
   } else if (actual_move.type == Move::Type::CLAIM) {
     LOG(INFO) << "LOG: [" << turn_id << "] P" << punter_id
               << ": CLAIM " << move.source << "-" << move.target;
-    common::Scorer(&scorer_).Claim(punter_id, move.source, move.target);
+    scorer_.Claim(punter_id, move.source, move.target);
     pass_count_[punter_id] = 0;
   } else if (actual_move.type == Move::Type::SPLURGE) {
     LOG(INFO) << "LOG: [" << turn_id << "] P" << punter_id
               << ": SPLURGE " << PrintVectorInt(move.route);
-    common::Scorer(&scorer_).Splurge(punter_id, move.route);
+    scorer_.Splurge(punter_id, move.route);
     pass_count_[punter_id] = 0;
   } else {
     LOG(INFO) << "LOG: [" << turn_id << "] P" << punter_id
               << ": OPTION " << move.source << "-" << move.target;
-    common::Scorer(&scorer_).Option(punter_id, move.source, move.target);
+    scorer_.Option(punter_id, move.source, move.target);
     pass_count_[punter_id] = 0;
   }
 
@@ -372,11 +337,10 @@ std::vector<int> Referee::Finish() {
 }
 
 std::vector<int> Referee::ComputeScores() const {
-  common::Scorer scorer(&scorer_);
   std::vector<int> scores;
   for (size_t punter_id = 0; punter_id < punter_info_list_.size();
        ++punter_id) {
-    scores.push_back(scorer.GetScore(punter_id));
+    scores.push_back(scorer_.GetScore(punter_id));
     LOG(INFO) << "Punter: " << punter_id << ", Score: " << scores.back();
   }
   return scores;
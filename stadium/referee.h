@@ -8,7 +8,7 @@
 #include "base/macros.h"
 #include "stadium/game_data.h"
 #include "stadium/punter.h"
-#include "common/scorer.pb.h"
+#include "common/scorer.h"
 
 namespace stadium {
 
@@ -25,11 +25,16 @@ class Referee {
   struct SiteState;
   struct RiverKey;
   struct RiverState;
+  // Sites and rivers are keyed by site index.
   struct MapState {
-    std::map<int, SiteState> sites;
+    SiteIndexMap site_index_map;
+    std::vector<SiteState> sites;
     std::map<RiverKey, RiverState> rivers;
 
     static MapState FromMap(const Map& map);
+
+    // Returns the river between the given site ids, or nullptr if none.
+    RiverState* FindRiver(int site_id1, int site_id2);
   };
 
   std::vector<int> ComputeScores() const;
@@ -45,7 +50,7 @@ class Referee {
   MapState map_state_;
   std::vector<Move> move_history_;
 
-  mutable common::ScorerProto scorer_;
+  common::Scorer scorer_;
   DISALLOW_COPY_AND_ASSIGN(Referee);
 };
 